@@ -0,0 +1,25 @@
+/*
+ * Bloom filter of the k-mers seen once.
+ */
+#include "bloom.h"
+#include "hugemem.h"
+
+int bloom_init(bloom_t* b, size_t bytes)
+{
+  size_t size = sizeof(uint64_t);
+  while(size < bytes)
+    size *= 2;
+  // probed at random: huge pages, zero until written
+  b->bits = (uint64_t*) hugemem_alloc(size);
+  if(b->bits == NULL)
+    return BLOOM_ERR;
+  b->mask = (uint64_t) size * 8 - 1;
+  return BLOOM_OK;
+}
+
+void bloom_free(bloom_t* b)
+{
+  hugemem_free(b->bits, (b->mask + 1) / 8);
+  b->bits = NULL;
+  b->mask = 0;
+}
@@ -0,0 +1,81 @@
+/**
+ *   \file bloom.h
+ *   \brief Bloom filter of the k-mers seen once.
+ *
+ *  Most distinct k-mers of a read set are sequencing errors, seen only
+ *  once.  A k-mer goes into the hash map only the second time it is
+ *  seen: the first time it only sets BLOOM_HASHES bits of the filter.
+ *  The map then counts it from 2.  A k-mer whose bits were all set by
+ *  others (a false positive, rate about (1 - e^(-3n/m))^3 for n k-mers
+ *  in m bits) is counted one too high; singletons are never counted.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLOOM_ERR -1   /* Memory error */
+#define BLOOM_OK 0     /* OK */
+
+#define BLOOM_HASHES 3
+
+typedef struct bloom_s
+{
+  uint64_t* bits;
+  uint64_t mask;   /* bits - 1, a power of 2 */
+} bloom_t;
+
+/*
+ * Set up an empty filter of at least "bytes" bytes (rounded up to a
+ * power of 2). Return BLOOM_OK or BLOOM_ERR.
+ */
+extern int bloom_init(bloom_t* b, size_t bytes);
+
+extern void bloom_free(bloom_t* b);
+
+/*
+ * 64-bit hash of the k-mer of "words" packed words, or of len bytes.
+ */
+static inline uint64_t bloom_hash_words(const uint64_t* key, int words)
+{
+  uint64_t h = 0x2545F4914F6CDD1DULL;
+  int i;
+  for(i = 0; i < words; i++)
+    {
+      h = (h ^ key[i]) * 0xFF51AFD7ED558CCDULL;
+      h ^= h >> 32;
+    }
+  return h;
+}
+
+static inline uint64_t bloom_hash_bytes(const char* key, size_t len)
+{
+  uint64_t h = 0xCBF29CE484222325ULL;   // FNV-1a
+  size_t i;
+  for(i = 0; i < len; i++)
+    h = (h ^ (unsigned char) key[i]) * 0x100000001B3ULL;
+  return h ^ (h >> 29);
+}
+
+/*
+ * Set the bits of hash h. Return 1 if they were all set already (the
+ * k-mer was probably seen), 0 else.
+ */
+static inline int bloom_add(bloom_t* b, uint64_t h)
+{
+  uint64_t step = (h >> 32) | 1, bit, word, seen = 1;
+  int i;
+  for(i = 0; i < BLOOM_HASHES; i++, h += step)
+    {
+      bit = h & b->mask;
+      word = 1ULL << (bit & 63);
+      seen &= (b->bits[bit >> 6] & word) != 0;
+      b->bits[bit >> 6] |= word;
+    }
+  return (int) seen;
+}
+
+#endif // __BLOOM_H__
@@ -0,0 +1,139 @@
+/*
+ * Compact saturating counters with a spill table.
+ */
+#include "ccount.h"
+#include "hugemem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SPILL (1 << 10)
+
+static inline size_t hash_index(uint64_t i)
+{
+  i *= 0x9E3779B97F4A7C15ULL;
+  return i ^ (i >> 29);
+}
+
+/*
+ * Pair holding index i, or the free pair where it goes.
+ */
+static uint64_t* probe(uint64_t* spill, size_t size, uint64_t i)
+{
+  size_t h = hash_index(i) & (size - 1);
+  uint64_t* pair;
+  for(;; h = (h + 1) & (size - 1))
+    {
+      pair = spill + 2 * h;
+      if(pair[0] == 0 || pair[0] == i + 1)
+	return pair;
+    }
+}
+
+static int grow(ccount_t* c)
+{
+  size_t h, size = c->spill_size ? 2 * c->spill_size : INITIAL_SPILL;
+  uint64_t* spill = (uint64_t*) calloc(size, 2 * sizeof(uint64_t));
+  uint64_t* to;
+  if(spill == NULL)
+    return CCOUNT_ERR;
+  for(h = 0; h < c->spill_size; h++)
+    if(c->spill[2 * h] != 0)
+      {
+	to = probe(spill, size, c->spill[2 * h] - 1);
+	to[0] = c->spill[2 * h];
+	to[1] = c->spill[2 * h + 1];
+      }
+  free(c->spill);
+  c->spill = spill;
+  c->spill_size = size;
+  return CCOUNT_OK;
+}
+
+int ccount_init(ccount_t* c, long long n_ent, int width)
+{
+  c->n_ent = n_ent;
+  c->width = (width == 1 || width == 2) ? width : 4;
+  c->max = (c->width == 1) ? UINT8_MAX
+    : (c->width == 2) ? UINT16_MAX : UINT32_MAX;
+  c->spill = NULL;
+  c->spill_size = c->spill_len = 0;
+  c->err = CCOUNT_OK;
+  c->cells = hugemem_alloc(n_ent * c->width);
+  if(c->cells == NULL)
+    return CCOUNT_ERR;
+  pthread_mutex_init(&c->lock, NULL);
+  return CCOUNT_OK;
+}
+
+void ccount_free(ccount_t* c)
+{
+  hugemem_free(c->cells, c->n_ent * c->width);
+  free(c->spill);
+  pthread_mutex_destroy(&c->lock);
+  c->cells = NULL;
+  c->spill = NULL;
+  c->spill_size = c->spill_len = 0;
+}
+
+void ccount_clear(ccount_t* c)
+{
+  hugemem_zero(c->cells, c->n_ent * c->width);
+  free(c->spill);
+  c->spill = NULL;
+  c->spill_size = c->spill_len = 0;
+  c->err = CCOUNT_OK;
+}
+
+void ccount_spill(ccount_t* c, uint64_t i, uint64_t v)
+{
+  uint64_t* pair;
+  pthread_mutex_lock(&c->lock);
+  // keep the load under 1/2, probe sequences stay short
+  if(2 * (c->spill_len + 1) > c->spill_size && grow(c) != CCOUNT_OK)
+    {
+      c->err = CCOUNT_ERR;
+      pthread_mutex_unlock(&c->lock);
+      return;
+    }
+  pair = probe(c->spill, c->spill_size, i);
+  if(pair[0] == 0)
+    {
+      pair[0] = i + 1;
+      c->spill_len++;
+    }
+  pair[1] += v;
+  pthread_mutex_unlock(&c->lock);
+}
+
+uint64_t ccount_spilled(ccount_t* c, uint64_t i)
+{
+  // read once the counting is over: no lock
+  if(c->spill_size == 0)
+    return 0;
+  return probe(c->spill, c->spill_size, i)[1];
+}
+
+void ccount_add(ccount_t* c, uint64_t i, uint64_t v)
+{
+  uint64_t cell = ccount_cell(c, i), left;
+  if(cell == c->max)
+    {
+      ccount_spill(c, i, v);
+      return;
+    }
+  // fill the cell up to max, the rest spills
+  left = c->max - cell;
+  if(v > left)
+    {
+      ccount_spill(c, i, v - left);
+      v = left;
+    }
+  cell += v;
+  if(c->width == 1)
+    ((uint8_t*) c->cells)[i] = cell;
+  else if(c->width == 2)
+    ((uint16_t*) c->cells)[i] = cell;
+  else
+    ((uint32_t*) c->cells)[i] = cell;
+}
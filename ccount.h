@@ -0,0 +1,134 @@
+/**
+ *   \file ccount.h
+ *   \brief Dense vector of compact saturating counters.
+ *
+ *  Most k-mers occur a few times: the counters of the vector are 8, 16
+ *  or 32 bits wide and stop at their largest value.  What a saturated
+ *  counter does not hold is kept in a small open addressing table keyed
+ *  by index (the spill table), shared by all the threads of a vector
+ *  under a mutex, and ccount_get adds both.  8-bit counters take a
+ *  quarter of the memory of the 32-bit ones.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __CCOUNT_H__
+#define __CCOUNT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define CCOUNT_ERR -1   /* Memory error */
+#define CCOUNT_OK 0     /* OK */
+
+typedef struct ccount_s
+{
+  void* cells;
+  long long n_ent;
+  int width;          /* bytes per counter: 1, 2 or 4 */
+  uint32_t max;       /* value of a saturated counter */
+  uint64_t* spill;    /* (index + 1, count over max) pairs, 0 if free */
+  size_t spill_size;  /* pairs, a power of 2 */
+  size_t spill_len;   /* pairs used */
+  int err;            /* CCOUNT_ERR once the spill table could not grow */
+  pthread_mutex_t lock;
+} ccount_t;
+
+/*
+ * Set up n_ent counters of "width" bytes (1, 2 or 4), all zero.
+ * Return CCOUNT_OK or CCOUNT_ERR.
+ */
+extern int ccount_init(ccount_t* c, long long n_ent, int width);
+
+extern void ccount_free(ccount_t* c);
+
+/*
+ * Set every counter back to zero, keeping the vector.
+ */
+extern void ccount_clear(ccount_t* c);
+
+/*
+ * Add v to the spilled part of counter i. Safe from any thread; on
+ * memory error c->err is set.
+ */
+extern void ccount_spill(ccount_t* c, uint64_t i, uint64_t v);
+
+/*
+ * Spilled part of counter i, read once no thread adds to c.
+ */
+extern uint64_t ccount_spilled(ccount_t* c, uint64_t i);
+
+/*
+ * Add one to counter i. "width" must be c->width, a constant where this
+ * is inlined, so each width gets its own loop.
+ */
+static inline __attribute__((always_inline))
+void ccount_inc_w(ccount_t* c, uint64_t i, const int width)
+{
+  if(width == 1)
+    {
+      uint8_t* p = (uint8_t*) c->cells + i;
+      if(*p != UINT8_MAX)
+	{
+	  (*p)++;
+	  return;
+	}
+    }
+  else if(width == 2)
+    {
+      uint16_t* p = (uint16_t*) c->cells + i;
+      if(*p != UINT16_MAX)
+	{
+	  (*p)++;
+	  return;
+	}
+    }
+  else
+    {
+      uint32_t* p = (uint32_t*) c->cells + i;
+      if(*p != UINT32_MAX)
+	{
+	  (*p)++;
+	  return;
+	}
+    }
+  ccount_spill(c, i, 1);
+}
+
+static inline void ccount_inc(ccount_t* c, uint64_t i)
+{
+  if(c->width == 1)
+    ccount_inc_w(c, i, 1);
+  else if(c->width == 2)
+    ccount_inc_w(c, i, 2);
+  else
+    ccount_inc_w(c, i, 4);
+}
+
+/*
+ * Value of the counter cell i, without the spill table.
+ */
+static inline uint32_t ccount_cell(const ccount_t* c, uint64_t i)
+{
+  if(c->width == 1)
+    return ((const uint8_t*) c->cells)[i];
+  if(c->width == 2)
+    return ((const uint16_t*) c->cells)[i];
+  return ((const uint32_t*) c->cells)[i];
+}
+
+/*
+ * Count of index i.
+ */
+static inline uint64_t ccount_get(ccount_t* c, uint64_t i)
+{
+  uint32_t v = ccount_cell(c, i);
+  return (v == c->max) ? v + ccount_spilled(c, i) : v;
+}
+
+/*
+ * Add v to counter i.
+ */
+extern void ccount_add(ccount_t* c, uint64_t i, uint64_t v);
+
+#endif // __CCOUNT_H__
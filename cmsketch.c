@@ -0,0 +1,36 @@
+/*
+ * Count-Min sketch of k-mer abundances.
+ */
+#include "cmsketch.h"
+#include "hugemem.h"
+
+#include <math.h>
+
+int cmsketch_init(cmsketch_t* c, uint64_t width, int depth)
+{
+  c->width = 1;
+  while(c->width < width)
+    c->width *= 2;
+  c->depth = (depth < 1) ? 1
+    : (depth > CMSKETCH_MAX_DEPTH) ? CMSKETCH_MAX_DEPTH : depth;
+  c->total = 0;
+  c->cells = (uint32_t*) hugemem_alloc(c->width * c->depth
+				       * sizeof(uint32_t));
+  return c->cells ? CMSKETCH_OK : CMSKETCH_ERR;
+}
+
+void cmsketch_free(cmsketch_t* c)
+{
+  hugemem_free(c->cells, c->width * c->depth * sizeof(uint32_t));
+  c->cells = NULL;
+}
+
+double cmsketch_error(const cmsketch_t* c)
+{
+  return M_E / c->width * c->total;
+}
+
+double cmsketch_confidence(const cmsketch_t* c)
+{
+  return 1.0 - exp(-c->depth);
+}
@@ -0,0 +1,96 @@
+/**
+ *   \file cmsketch.h
+ *   \brief Count-Min sketch of k-mer abundances.
+ *
+ *  An approximate counter in fixed memory: "depth" rows of "width"
+ *  counters, a k-mer adding to one counter per row, picked by a hash.
+ *  The estimate of a k-mer is the smallest of its counters: never
+ *  below its count, and above by at most e / width of all the k-mers
+ *  counted with probability 1 - e^-depth.  With conservative update
+ *  only the counters at that smallest value are incremented, which
+ *  keeps the bound and makes the estimates much closer.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __CMSKETCH_H__
+#define __CMSKETCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CMSKETCH_ERR -1   /* Memory error */
+#define CMSKETCH_OK 0     /* OK */
+
+#define CMSKETCH_MAX_DEPTH 16
+
+typedef struct cmsketch_s
+{
+  uint32_t* cells;   /* depth rows of width counters */
+  uint64_t width;    /* a power of 2 */
+  int depth;
+  uint64_t total;    /* k-mers counted */
+} cmsketch_t;
+
+/*
+ * Set up a sketch of depth rows (up to CMSKETCH_MAX_DEPTH) of at least
+ * width counters (rounded up to a power of 2), all zero.
+ * Return CMSKETCH_OK or CMSKETCH_ERR.
+ */
+extern int cmsketch_init(cmsketch_t* c, uint64_t width, int depth);
+
+extern void cmsketch_free(cmsketch_t* c);
+
+/*
+ * Largest overestimate with probability cmsketch_confidence.
+ */
+extern double cmsketch_error(const cmsketch_t* c);
+
+extern double cmsketch_confidence(const cmsketch_t* c);
+
+/*
+ * Counter of row i for the k-mer of 64-bit hash h.
+ */
+static inline uint32_t* cmsketch_cell(cmsketch_t* c, uint64_t h, int i)
+{
+  uint64_t x = h + (uint64_t) (i + 1) * 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 32)) * 0xD6E8FEB86659FD93ULL;
+  x ^= x >> 32;
+  return c->cells + (uint64_t) i * c->width + (x & (c->width - 1));
+}
+
+/*
+ * Count the k-mer of hash h once, conservatively.
+ */
+static inline void cmsketch_add(cmsketch_t* c, uint64_t h)
+{
+  uint32_t* cell[CMSKETCH_MAX_DEPTH];
+  uint32_t min = UINT32_MAX;
+  int i;
+  for(i = 0; i < c->depth; i++)
+    {
+      cell[i] = cmsketch_cell(c, h, i);
+      if(*cell[i] < min)
+	min = *cell[i];
+    }
+  c->total++;
+  if(min == UINT32_MAX)
+    return;
+  for(i = 0; i < c->depth; i++)
+    if(*cell[i] == min)
+      *cell[i] = min + 1;
+}
+
+/*
+ * Estimated count of the k-mer of hash h.
+ */
+static inline uint32_t cmsketch_query(cmsketch_t* c, uint64_t h)
+{
+  uint32_t min = UINT32_MAX, v;
+  int i;
+  for(i = 0; i < c->depth; i++)
+    if((v = *cmsketch_cell(c, h, i)) < min)
+      min = v;
+  return min;
+}
+
+#endif // __CMSKETCH_H__
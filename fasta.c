@@ -0,0 +1,335 @@
+/*
+ * Zero-copy fasta reader built on mmap.
+ */
+#include "fasta.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define INITIAL_RECORDS (5000)
+#define MIN_RANGE (1 << 20)
+
+/* fasta_stream_t states */
+#define ST_PREAMBLE 0
+#define ST_HEADER 1
+#define ST_SEQ 2
+
+int fasta_open(fasta_file_t* f, const char* path)
+{
+  struct stat st;
+  void* p;
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return FASTA_ERR;
+  if(fstat(fd, &st) != 0)
+    {
+      close(fd);
+      return FASTA_ERR;
+    }
+  f->data = NULL;
+  f->size = st.st_size;
+  f->pos = 0;
+  f->mapped = 0;
+  if(f->size > 0)
+    {
+      p = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(p == MAP_FAILED)
+	{
+	  close(fd);
+	  return FASTA_ERR;
+	}
+      madvise(p, f->size, MADV_SEQUENTIAL);
+      f->data = (const char*) p;
+      f->mapped = 1;
+    }
+  // the mapping stays valid after closing the descriptor
+  close(fd);
+  return FASTA_OK;
+}
+
+void fasta_from_buffer(fasta_file_t* f, const char* data, size_t size)
+{
+  f->data = data;
+  f->size = size;
+  f->pos = 0;
+  f->mapped = 0;
+}
+
+/*
+ * Return the offset of the first header ('>' at the start of a line)
+ * at or after "pos", or the file size if there is none.
+ */
+static size_t next_header(const fasta_file_t* f, size_t pos)
+{
+  const char* p;
+  while(pos < f->size)
+    {
+      if(f->data[pos] == '>' && (pos == 0 || f->data[pos - 1] == '\n'))
+	return pos;
+      p = (const char*) memchr(f->data + pos, '\n', f->size - pos);
+      if(p == NULL)
+	return f->size;
+      pos = p - f->data + 1;
+    }
+  return f->size;
+}
+
+/*
+ * Parse the record whose header is the first one at or after *pos,
+ * provided that header starts before "limit".
+ */
+static int next_record(const fasta_file_t* f, size_t* pos, size_t limit,
+		       fasta_seq_t* seq)
+{
+  const char* p;
+  size_t start, end;
+
+  start = next_header(f, *pos);
+  if(start >= limit)
+    {
+      *pos = f->size;
+      return FASTA_END;
+    }
+  // skip the header line
+  p = (const char*) memchr(f->data + start, '\n', f->size - start);
+  start = (p == NULL) ? f->size : (size_t)(p - f->data) + 1;
+  end = next_header(f, start);
+
+  seq->start = f->data + start;
+  seq->len = end - start;
+  *pos = end;
+  return FASTA_OK;
+}
+
+int fasta_next(fasta_file_t* f, fasta_seq_t* seq)
+{
+  return next_record(f, &f->pos, f->size, seq);
+}
+
+/*
+ * Collect the records whose header starts in [lo, hi).
+ */
+static int index_range(const fasta_file_t* f, size_t lo, size_t hi,
+		       fasta_seq_t** all, size_t* n)
+{
+  size_t sz = INITIAL_RECORDS;
+  fasta_seq_t* v = (fasta_seq_t*) malloc(sz * sizeof(fasta_seq_t));
+  if(v == NULL)
+    return FASTA_ERR;
+  *n = 0;
+  while(next_record(f, &lo, hi, &v[*n]) == FASTA_OK)
+    {
+      if(++(*n) == sz)
+	{
+	  fasta_seq_t* t;
+	  sz *= 2;
+	  t = (fasta_seq_t*) realloc(v, sz * sizeof(fasta_seq_t));
+	  if(t == NULL)
+	    {
+	      free(v);
+	      return FASTA_ERR;
+	    }
+	  v = t;
+	}
+    }
+  *all = v;
+  return FASTA_OK;
+}
+
+int fasta_index(fasta_file_t* f, fasta_seq_t** all, size_t* n)
+{
+  int err = index_range(f, f->pos, f->size, all, n);
+  f->pos = f->size;
+  return err;
+}
+
+/* Work of one fasta_index_parallel thread */
+typedef struct index_job_s
+{
+  const fasta_file_t* f;
+  size_t lo, hi;
+  fasta_seq_t* v;
+  size_t n;
+  int err;
+  int running;
+  pthread_t tid;
+} index_job_t;
+
+static void* index_worker(void* arg)
+{
+  index_job_t* job = (index_job_t*) arg;
+  job->err = index_range(job->f, job->lo, job->hi, &job->v, &job->n);
+  return NULL;
+}
+
+int fasta_index_parallel(fasta_file_t* f, int nthreads, fasta_seq_t** all,
+			 size_t* n)
+{
+  int t, err = FASTA_OK;
+  size_t len = f->size - f->pos;
+  index_job_t* jobs;
+
+  // do not split below MIN_RANGE bytes per thread
+  if(nthreads > len / MIN_RANGE + 1)
+    nthreads = len / MIN_RANGE + 1;
+  if(nthreads <= 1)
+    return fasta_index(f, all, n);
+
+  jobs = (index_job_t*) calloc(nthreads, sizeof(index_job_t));
+  if(jobs == NULL)
+    return FASTA_ERR;
+  // each worker owns the records whose header falls in its byte range,
+  // it moves forward to the first header of the range on its own
+  for(t = 0; t < nthreads; t++)
+    {
+      jobs[t].f = f;
+      jobs[t].lo = f->pos + len * t / nthreads;
+      jobs[t].hi = f->pos + len * (t + 1) / nthreads;
+      jobs[t].running =
+	(pthread_create(&jobs[t].tid, NULL, index_worker, &jobs[t]) == 0);
+      if(!jobs[t].running)
+	index_worker(&jobs[t]);
+    }
+  *n = 0;
+  for(t = 0; t < nthreads; t++)
+    {
+      if(jobs[t].running)
+	pthread_join(jobs[t].tid, NULL);
+      if(jobs[t].err != FASTA_OK)
+	err = FASTA_ERR;
+      else
+	*n += jobs[t].n;
+    }
+
+  // concatenate the ranges so records keep their order in the file
+  *all = NULL;
+  if(err == FASTA_OK)
+    {
+      *all = (fasta_seq_t*) malloc((*n + 1) * sizeof(fasta_seq_t));
+      if(*all == NULL)
+	err = FASTA_ERR;
+    }
+  *n = 0;
+  for(t = 0; t < nthreads; t++)
+    {
+      if(err == FASTA_OK)
+	{
+	  memcpy(*all + *n, jobs[t].v, jobs[t].n * sizeof(fasta_seq_t));
+	  *n += jobs[t].n;
+	}
+      free(jobs[t].v);
+    }
+  free(jobs);
+  f->pos = f->size;
+  return err;
+}
+
+void fasta_close(fasta_file_t* f)
+{
+  if(f->mapped)
+    munmap((void*) f->data, f->size);
+  f->data = NULL;
+  f->size = 0;
+  f->mapped = 0;
+}
+
+int fasta_stream_open(fasta_stream_t* s, const char* path, size_t buf_size)
+{
+  if(strcmp(path, "-") == 0)
+    s->fd = STDIN_FILENO;
+  else
+    s->fd = open(path, O_RDONLY);
+  if(s->fd < 0)
+    return FASTA_ERR;
+  s->buf = (char*) malloc(buf_size);
+  if(s->buf == NULL)
+    {
+      fasta_stream_close(s);
+      return FASTA_ERR;
+    }
+  s->cap = buf_size;
+  s->len = 0;
+  s->pos = 0;
+  s->state = ST_PREAMBLE;
+  s->bol = 1;
+  s->fresh = 0;
+  return FASTA_OK;
+}
+
+/*
+ * Reuse the buffer once it has been consumed.
+ * Return 1 if there is data to parse, 0 at end of input, -1 on error.
+ */
+static int stream_fill(fasta_stream_t* s)
+{
+  ssize_t n;
+  if(s->pos < s->len)
+    return 1;
+  do
+    n = read(s->fd, s->buf, s->cap);
+  while(n < 0 && errno == EINTR);
+  if(n < 0)
+    return -1;
+  s->pos = 0;
+  s->len = n;
+  return n > 0;
+}
+
+int fasta_stream_next(fasta_stream_t* s, fasta_seq_t* chunk, int* new_record)
+{
+  int st;
+  const char *p, *nl, *end;
+
+  while((st = stream_fill(s)) > 0)
+    {
+      p = s->buf + s->pos;
+      end = s->buf + s->len;
+      if(s->bol && *p == '>')
+	{
+	  s->state = ST_HEADER;
+	  s->fresh = 1;
+	}
+      if(s->state == ST_HEADER)
+	{
+	  // drop the header line, it may span several buffers
+	  nl = (const char*) memchr(p, '\n', end - p);
+	  s->bol = (nl != NULL);
+	  if(nl != NULL)
+	    s->state = ST_SEQ;
+	  s->pos = (nl == NULL) ? s->len : (size_t)(nl - s->buf) + 1;
+	  continue;
+	}
+      // sequence text (or junk before the first header) up to the next
+      // header or the end of the buffer
+      nl = p;
+      while((nl = (const char*) memchr(nl, '\n', end - nl)) != NULL)
+	if(++nl == end || *nl == '>')
+	  break;
+      if(nl == NULL)
+	nl = end;
+      s->bol = (nl[-1] == '\n');
+      s->pos = nl - s->buf;
+      if(s->state == ST_PREAMBLE)
+	continue;
+      chunk->start = p;
+      chunk->len = nl - p;
+      *new_record = s->fresh;
+      s->fresh = 0;
+      return FASTA_OK;
+    }
+  return (st < 0) ? FASTA_ERR : FASTA_END;
+}
+
+void fasta_stream_close(fasta_stream_t* s)
+{
+  if(s->fd > STDIN_FILENO)
+    close(s->fd);
+  s->fd = -1;
+  free(s->buf);
+  s->buf = NULL;
+}
@@ -0,0 +1,171 @@
+/**
+ *   \file fasta.h
+ *   \brief Zero-copy "fna" / "fasta" reader.
+ *
+ *  The input file is mapped in memory with mmap and every record is
+ *  handed to the caller as a (start, length) view of its sequence
+ *  lines, line breaks included.  The cursor functions walk a view
+ *  skipping the line breaks, so no base is ever copied.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __FASTA_H__
+#define __FASTA_H__
+
+#include <stddef.h>
+#include <string.h>
+
+#define FASTA_END -2    /* No more records */
+#define FASTA_ERR -1    /* Open, map or memory error */
+#define FASTA_OK 0      /* OK */
+
+/*
+ * View of one record: the text between the end of its header line and
+ * the next header (or the end of file).  It points into the mapped
+ * file and is valid until fasta_close.
+ */
+typedef struct fasta_seq_s
+{
+  const char* start;
+  size_t len;
+} fasta_seq_t;
+
+/*
+ * An input file (or any buffer holding fasta text) and the parse
+ * position of fasta_next.
+ */
+typedef struct fasta_file_s
+{
+  const char* data;
+  size_t size;
+  size_t pos;
+  int mapped;   /* data must be unmapped by fasta_close */
+} fasta_file_t;
+
+/*
+ * Reads fasta text through a fixed size buffer, for inputs that must
+ * not (or cannot) be held in memory: pipes, or files larger than RAM.
+ */
+typedef struct fasta_stream_s
+{
+  int fd;
+  char* buf;
+  size_t cap;
+  size_t len;
+  size_t pos;
+  int state;    /* before first record, in a header or in a sequence */
+  int bol;      /* next byte starts a line */
+  int fresh;    /* a header was seen since the last chunk */
+} fasta_stream_t;
+
+/*
+ * Walks a record view base by base or line by line.
+ */
+typedef struct fasta_cursor_s
+{
+  const char* p;
+  const char* end;
+} fasta_cursor_t;
+
+/*
+ * Map the file "path" in memory. Return FASTA_OK or FASTA_ERR.
+ */
+extern int fasta_open(fasta_file_t* f, const char* path);
+
+/*
+ * Parse fasta text already in memory (not owned by f).
+ */
+extern void fasta_from_buffer(fasta_file_t* f, const char* data, size_t size);
+
+/*
+ * Get the next record. Return FASTA_OK or FASTA_END.
+ */
+extern int fasta_next(fasta_file_t* f, fasta_seq_t* seq);
+
+/*
+ * Collect the views of all records into a malloc'd array (*all, *n).
+ * Return FASTA_OK or FASTA_ERR.
+ */
+extern int fasta_index(fasta_file_t* f, fasta_seq_t** all, size_t* n);
+
+/*
+ * Same as fasta_index, splitting the file in byte ranges parsed by up
+ * to nthreads threads. Each range is resynchronized on the next header,
+ * and records are returned in their order in the file.
+ */
+extern int fasta_index_parallel(fasta_file_t* f, int nthreads,
+				fasta_seq_t** all, size_t* n);
+
+/*
+ * Unmap the file.
+ */
+extern void fasta_close(fasta_file_t* f);
+
+/*
+ * Open "path" ("-" is the standard input) for streaming with a buffer
+ * of buf_size bytes. Return FASTA_OK or FASTA_ERR.
+ */
+extern int fasta_stream_open(fasta_stream_t* s, const char* path,
+			     size_t buf_size);
+
+/*
+ * Get the next chunk of sequence text. A record may be split in many
+ * chunks; *new_record is 1 on the first chunk of each record. The chunk
+ * is valid until the next call. Return FASTA_OK, FASTA_END or FASTA_ERR.
+ */
+extern int fasta_stream_next(fasta_stream_t* s, fasta_seq_t* chunk,
+			     int* new_record);
+
+/*
+ * Close the input and free the buffer.
+ */
+extern void fasta_stream_close(fasta_stream_t* s);
+
+static inline void fasta_cursor_init(fasta_cursor_t* c, const fasta_seq_t* seq)
+{
+  c->p = seq->start;
+  c->end = seq->start + seq->len;
+}
+
+/*
+ * Return the next base of the record, or -1 at the end of it.
+ */
+static inline int fasta_cursor_next(fasta_cursor_t* c)
+{
+  while(c->p < c->end)
+    {
+      char b = *c->p++;
+      if(b != '\n' && b != '\r')
+	return (unsigned char) b;
+    }
+  return -1;
+}
+
+/*
+ * Point *line to the next run of at most "max" bases without line
+ * breaks and return its length, or 0 at the end of the record.
+ */
+static inline size_t fasta_cursor_line(fasta_cursor_t* c, const char** line,
+				       size_t max)
+{
+  const char* nl;
+  size_t len;
+
+  while(c->p < c->end && (*c->p == '\n' || *c->p == '\r'))
+    c->p++;
+  if(c->p == c->end)
+    return 0;
+  if(max > (size_t)(c->end - c->p))
+    max = c->end - c->p;
+  nl = (const char*) memchr(c->p, '\n', max);
+  if(nl == NULL)
+    nl = c->p + max;
+  *line = c->p;
+  len = nl - c->p;
+  c->p = nl;
+  if(len > 0 && (*line)[len - 1] == '\r')
+    len--;
+  return len;
+}
+
+#endif // __FASTA_H__
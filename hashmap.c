@@ -6,9 +6,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #define INITIAL_SIZE (256)
 #define MAX_CHAIN_LENGTH (32)
+#define SLAB_SIZE (1 << 20)
 
 /* We need to keep keys and values */
 typedef struct _hashmap_element{
@@ -17,25 +19,57 @@ typedef struct _hashmap_element{
 	any_t data;
 } hashmap_element;
 
+/* Block of the keys and values inserted by hashmap_upsert */
+typedef struct _hashmap_slab{
+	struct _hashmap_slab* next;
+	size_t used;
+	size_t size;
+	char bytes[];
+} hashmap_slab;
+
 /* A hashmap has some maximum size and current size,
  * as well as the data to hold. */
 typedef struct _hashmap_map{
 	int table_size;
 	int size;
 	hashmap_element *data;
+	int value_size;
+	hashmap_slab* slabs;
 } hashmap_map;
 
 /*
  * Return an empty hashmap, or NULL on failure.
  */
 map_t hashmap_new() {
+	return hashmap_new_size(0);
+}
+
+/*
+ * Return an empty hashmap holding n elements before its first rehash
+ * (the table is kept at most half full), or NULL on failure.
+ */
+map_t hashmap_new_size(int n) {
+	return hashmap_new_values(n, 0);
+}
+
+/*
+ * Same as hashmap_new_size, for elements inserted by hashmap_upsert
+ * with values of value_size bytes.
+ */
+map_t hashmap_new_values(int n, int value_size) {
+	int table_size = INITIAL_SIZE;
 	hashmap_map* m = (hashmap_map*) malloc(sizeof(hashmap_map));
 	if(!m) goto err;
+	m->data = NULL;
+	m->slabs = NULL;
+	m->value_size = value_size;
 
-	m->data = (hashmap_element*) calloc(INITIAL_SIZE, sizeof(hashmap_element));
+	if(n < INT_MAX / 2 && 2 * n + 1 > table_size)
+		table_size = 2 * n + 1;
+	m->data = (hashmap_element*) calloc(table_size, sizeof(hashmap_element));
 	if(!m->data) goto err;
 
-	m->table_size = INITIAL_SIZE;
+	m->table_size = table_size;
 	m->size = 0;
 
 	return m;
@@ -162,11 +196,12 @@ unsigned long crc32(const unsigned char *s, unsigned int len)
 }
 
 /*
- * Hashing function for a string
+ * Hashing function for the len bytes of a key, before it is reduced to
+ * the table size
  */
-unsigned int hashmap_hash_int(hashmap_map * m, char* keystring){
+static unsigned long hash_bytes(const char* keystring, unsigned int len){
 
-    unsigned long key = crc32((unsigned char*)(keystring), strlen(keystring));
+    unsigned long key = crc32((const unsigned char*)(keystring), len);
 
 	/* Robert Jenkins' 32 bit Mix Function */
 	key += (key << 12);
@@ -181,7 +216,14 @@ unsigned int hashmap_hash_int(hashmap_map * m, char* keystring){
 	/* Knuth's Multiplicative Method */
 	key = (key >> 3) * 2654435761;
 
-	return key % m->table_size;
+	return key;
+}
+
+/*
+ * Hashing function for a string
+ */
+unsigned int hashmap_hash_int(hashmap_map * m, char* keystring){
+	return hash_bytes(keystring, strlen(keystring)) % m->table_size;
 }
 
 /*
@@ -283,6 +325,76 @@ int hashmap_put(map_t in, char* key, any_t value){
 	return MAP_OK;
 }
 
+/*
+ * Take size bytes (a multiple of 8) from the slabs of the map
+ */
+static char* slab_alloc(hashmap_map* m, size_t size){
+	hashmap_slab* s = m->slabs;
+	char* p;
+
+	if(s == NULL || s->size - s->used < size){
+		size_t bytes = (size > SLAB_SIZE) ? size : SLAB_SIZE;
+		s = (hashmap_slab*) malloc(sizeof(hashmap_slab) + bytes);
+		if(!s) return NULL;
+		s->size = bytes;
+		s->used = 0;
+		s->next = m->slabs;
+		m->slabs = s;
+	}
+	p = s->bytes + s->used;
+	s->used += size;
+	return p;
+}
+
+/*
+ * Find the element of a key of len bytes, or insert it, with a single
+ * probe sequence
+ */
+int hashmap_upsert(map_t in, const char* key, int len, any_t *slot){
+	int curr;
+	int i;
+	unsigned long hash = hash_bytes(key, len);
+	hashmap_element* e;
+	char* entry;
+
+	/* Cast the hashmap */
+	hashmap_map* m = (hashmap_map *) in;
+
+	for(;;){
+		/* Linear probing, up to the key or a free element */
+		curr = hash % m->table_size;
+		for(i = 0; i < MAX_CHAIN_LENGTH; i++){
+			e = &m->data[curr];
+			if(e->in_use == 0)
+				break;
+			if(strncmp(e->key, key, len) == 0 && e->key[len] == '\0'){
+				*slot = e->data;
+				return MAP_OK;
+			}
+			curr = (curr + 1) % m->table_size;
+		}
+		if(i < MAX_CHAIN_LENGTH && m->size < m->table_size/2)
+			break;
+		if(hashmap_rehash(in) == MAP_OMEM)
+			return MAP_OMEM;
+	}
+
+	/* The value, then the key, in the slabs */
+	entry = slab_alloc(m, (m->value_size + len + 1 + 7) & ~(size_t) 7);
+	if(!entry) return MAP_OMEM;
+	memset(entry, 0, m->value_size);
+	memcpy(entry + m->value_size, key, len);
+	entry[m->value_size + len] = '\0';
+
+	e->data = entry;
+	e->key = entry + m->value_size;
+	e->in_use = 1;
+	m->size++;
+
+	*slot = entry;
+	return MAP_MISSING;
+}
+
 /*
  * Get your pointer out of the hashmap with a key
  */
@@ -382,9 +494,15 @@ int hashmap_remove(map_t in, char* key){
 	return MAP_MISSING;
 }
 
-/* Deallocate the hashmap */
+/* Deallocate the hashmap, and the elements inserted by hashmap_upsert */
 void hashmap_free(map_t in){
 	hashmap_map* m = (hashmap_map*) in;
+	hashmap_slab* s;
+	while(m->slabs != NULL){
+		s = m->slabs;
+		m->slabs = s->next;
+		free(s);
+	}
 	free(m->data);
 	free(m);
 }
@@ -38,6 +38,17 @@ typedef any_t map_t;
 */
 extern map_t hashmap_new();
 
+/*
+ * Return an empty hashmap sized for n elements. Returns NULL on failure.
+ */
+extern map_t hashmap_new_size(int n);
+
+/*
+ * Return an empty hashmap sized for n elements, whose elements inserted
+ * by hashmap_upsert hold value_size bytes. Returns NULL on failure.
+ */
+extern map_t hashmap_new_values(int n, int value_size);
+
 /*
  * Iteratively call f with argument (item, data) for
  * each element data in the hashmap. The function must
@@ -57,6 +68,16 @@ extern int hashmap_put(map_t in, char* key, any_t value);
  */
 extern int hashmap_get(map_t in, char* key, any_t *arg);
 
+/*
+ * Find the element of the key of len bytes (no '\0' needed), or insert
+ * it, hashing and probing the key once. *slot is set to the value of
+ * the element: on insertion, value_size zero bytes followed by a copy of
+ * the key and a '\0', both owned by the map and freed by hashmap_free.
+ * Return MAP_OK when the key was held, MAP_MISSING when it was
+ * inserted, or MAP_OMEM.
+ */
+extern int hashmap_upsert(map_t in, const char* key, int len, any_t *slot);
+
 /*
  * Remove an element from the hashmap. Return MAP_OK or MAP_MISSING.
  */
@@ -78,4 +99,4 @@ extern void hashmap_free(map_t in);
  */
 extern int hashmap_length(map_t in);
 
-#endif __HASHMAP_H__
\ No newline at end of file
+#endif // __HASHMAP_H__
\ No newline at end of file
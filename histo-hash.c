@@ -8,10 +8,55 @@
  *  Using Pete Warden simple hashmap implementation
  *     - http://petewarden.typepad.com/
  *     - https://github.com/petewarden/c_hashmap
+ *  K-mers of up to 32 bases are encoded by kmer.h and counted in a kmap,
+ *  keyed by their 64-bit index; up to 128 bases they are packed 2 bits
+ *  per base in 128 or 256-bit keys and counted in a wkmap, longer ones
+ *  keep string keys.
  *
- *   Compile: gcc -Wall -c hashmap.c
- *            gcc -Wall -o histo-hash histo-hash.c hashmap.o -lm
+ *   Compile: gcc -Wall -c hashmap.c wkmap.c kmap.c fasta.c kmer.c nucpack.c \
+ *                seqstore.c bloom.c hugemem.c cmsketch.c hll.c
+ *            gcc -Wall -o histo-hash histo-hash.c hashmap.o wkmap.o kmap.o \
+ *                fasta.o kmer.o nucpack.o seqstore.o bloom.o hugemem.o \
+ *                cmsketch.o hll.o -lm -pthread
  *   Use:  ./histo-hash Bancomini.dat 31 out.dat
+ *         ./histo-hash --stream - 31 out.dat < Bancomini.dat
+ *         ./histo-hash --sketch --query-file kmers.txt Bancomini.dat 31 out.dat
+ *
+ *   Options:
+ *     -s, --stream   count k-mers while the input is read through a fixed
+ *                    size buffer, no sequence is kept in memory
+ *     -t, --threads  number of threads parsing the input (default 1)
+ *     -c, --canonical  count each k-mer together with its reverse
+ *                    complement, keyed by the smaller of both
+ *     -C, --cache    pack the sequences 2 bits per base and save them in
+ *                    <file>.sqs; while <file> is not modified, later
+ *                    runs (of any driver) map that cache instead of
+ *                    parsing the text
+ *     -b, --bloom    MB of a Bloom filter (bloom.h) the k-mers go through
+ *                    first: a k-mer enters the map the second time it
+ *                    is seen, singletons are not counted. About 1 byte
+ *                    per distinct k-mer keeps the counts exact but for
+ *                    a few percent of k-mers counted one too high
+ *     -m, --min-count  only write the k-mers counted at least this
+ *                    many times
+ *
+ *     -k, --sketch   approximate counts in a Count-Min sketch (cmsketch.h)
+ *                    of fixed size instead of a map; the output file
+ *                    holds the estimates of the k-mers queried, the
+ *                    error bound is printed
+ *     -W, --sketch-width  counters per row of the sketch (default 2^22)
+ *     -D, --sketch-depth  rows of the sketch (default 4)
+ *     -q, --query    k-mer to look up in the sketch (repeatable)
+ *     -Q, --query-file  file of k-mers to look up, one per line
+ *
+ *     -e, --estimate  first estimate the distinct k-mers with a
+ *                    HyperLogLog pass (hll.h) and size the map for them,
+ *                    so it does not grow while counting. With --stream
+ *                    the file is read twice, it cannot be "-"
+ *     -E, --estimate-only  print the estimate and stop
+ *     -P, --estimate-sample  percentage of the records the estimate
+ *                    reads, scaled up (default 100; below, an upper
+ *                    bound when records share k-mers)
  *  
  *   \Author: Danny Múnera - Parallel Programing UdeA 
  */
@@ -21,122 +66,307 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <ctype.h>
 #include <sys/time.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
 
 #include "hashmap.h"
+#include "wkmap.h"
+#include "kmap.h"
+#include "fasta.h"
+#include "kmer.h"
+#include "seqstore.h"
+#include "bloom.h"
+#include "cmsketch.h"
+#include "hll.h"
 
-#define MAX_SQ 5000
-#define MAX_LINE 1000
+#define STREAM_BUF (1 << 20)
 
 #define KEY_MAX_LENGTH (256)
 #define KEY_COUNT (1024*1024)
 
+#define SKETCH_WIDTH (1 << 22)   /* 16 MB per row */
+#define SKETCH_DEPTH 4
+#define MAX_QUERIES 64
+
 typedef struct mapent_s
 {
-    char key_string[KEY_MAX_LENGTH];
     int number;
+    char key_string[];   /* copied after the count by hashmap_upsert */
 } mapent_t;
 
 // Global variable Hashmap 
 map_t mymap;
+// Counter of packed keys, used when KMER_MAX_K < k_mers <= WKMER_MAX_K
+wkmap_t widemap;
+int wide = 0, wide_k;
+// Counter of k-mer indexes, used when k_mers <= KMER_MAX_K
+kmap_t narrowmap;
+int narrow = 0;
+// Count canonical k-mers
+int canonical = 0;
+// Filter of the k-mers seen once, with --bloom
+bloom_t* filter = NULL;
+// Smallest count written
+uint64_t min_count = 0;
+// Approximate counter, with --sketch
+cmsketch_t* sketch = NULL;
+// Distinct k-mer estimator, during the --estimate pass
+hll_t* estimator = NULL;
+// Records read: one in record_step
+size_t record_step = 1;
 
 //#define DEBUG
 
-void process_all_sq (char** all, size_t sq_num, int k_mers);
+void process_input (const char* in_file, int stream, const seqstore_t* store,
+		    fasta_seq_t* all_sq, size_t n_seq, int k_mers);
+void process_all_sq (fasta_seq_t* all, size_t sq_num, int k_mers);
+void process_all_store (const seqstore_t* store, int k_mers);
+void process_stream (fasta_stream_t* in, int k_mers);
+void process_sq (const fasta_seq_t* sq, int k_mers, char* sub_sq, char* sub_rc,
+		 int* filled);
+void process_wide_sq (const fasta_seq_t* sq, wkmer_roll_t* r);
+void process_narrow_sq (const fasta_seq_t* sq, kmer_roll_t* r);
 int printent(void* fd, void * data);
+int printwide(void* fd, const uint64_t* key, uint64_t count);
+int printnarrow(void* fd, uint64_t key, uint64_t count);
+void query_sketch (FILE* outfp, const char* kmer, int k_mers);
   
+static struct option long_opts[] = {
+  {"stream", no_argument, NULL, 's'},
+  {"threads", required_argument, NULL, 't'},
+  {"canonical", no_argument, NULL, 'c'},
+  {"cache", no_argument, NULL, 'C'},
+  {"bloom", required_argument, NULL, 'b'},
+  {"min-count", required_argument, NULL, 'm'},
+  {"sketch", no_argument, NULL, 'k'},
+  {"sketch-width", required_argument, NULL, 'W'},
+  {"sketch-depth", required_argument, NULL, 'D'},
+  {"query", required_argument, NULL, 'q'},
+  {"query-file", required_argument, NULL, 'Q'},
+  {"estimate", no_argument, NULL, 'e'},
+  {"estimate-only", no_argument, NULL, 'E'},
+  {"estimate-sample", required_argument, NULL, 'P'},
+  {NULL, 0, NULL, 0}
+};
+
 int main(int argc, char *argv[])
 {
-  if (argc != 4)
+  int opt, stream = 0, nthreads = 1, cache = 0;
+  long long bloom_mb = 0;
+  int use_sketch = 0, sketch_depth = SKETCH_DEPTH, n_queries = 0;
+  uint64_t sketch_width = SKETCH_WIDTH;
+  char* queries[MAX_QUERIES];
+  char* query_file = NULL;
+  int estimate = 0, estimate_only = 0;
+  double sample_pct = 100;
+  while ((opt = getopt_long(argc, argv, "st:cCb:m:kW:D:q:Q:eEP:", long_opts,
+			    NULL)) != -1)
     {
-      fprintf(stderr, "ERROR - usage: histo <file> k_mers <outfile>\n");
+      switch (opt) {
+      case 's':
+	stream = 1;
+	break;
+      case 't':
+	nthreads = strtol(optarg, NULL, 10);
+	break;
+      case 'c':
+	canonical = 1;
+	break;
+      case 'C':
+	cache = 1;
+	break;
+      case 'b':
+	bloom_mb = strtoll(optarg, NULL, 10);
+	break;
+      case 'm':
+	min_count = strtoull(optarg, NULL, 10);
+	break;
+      case 'k':
+	use_sketch = 1;
+	break;
+      case 'W':
+	sketch_width = strtoull(optarg, NULL, 10);
+	break;
+      case 'D':
+	sketch_depth = strtol(optarg, NULL, 10);
+	break;
+      case 'q':
+	if (n_queries < MAX_QUERIES)
+	  queries[n_queries++] = optarg;
+	break;
+      case 'Q':
+	query_file = optarg;
+	break;
+      case 'E':
+	estimate_only = 1;
+	// fall through
+      case 'e':
+	estimate = 1;
+	break;
+      case 'P':
+	sample_pct = strtod(optarg, NULL);
+	break;
+      default:
+	argc = 0; // print usage
+	break;
+      }
+    }
+  if (argc - optind != 3)
+    {
+      fprintf(stderr, "ERROR - usage: histo [--stream] [--threads N] [--canonical] [--cache] [--bloom MB] [--min-count N] [--sketch [--sketch-width N] [--sketch-depth N] [--query KMER]... [--query-file FILE]] [--estimate|--estimate-only [--estimate-sample PCT]] <file> k_mers <outfile>\n");
       exit(1);
     }
   char in_file[200];
   char out_file[200];
   int k_mers;
-  char sq_buffer[MAX_SQ], temp_buf[MAX_LINE];
-  size_t sq_len, ln_len;
   struct timeval t1, t2;
   double elapsedTime;  
 
-  mymap = hashmap_new();
-  
-  strcpy(in_file, argv[1]);
-  k_mers = strtol(argv[2], NULL, 10);
-  strcpy(out_file, argv[3]);
-  
-  // Data structure for sequences
-  int all_sq_sz = MAX_SQ;
-  char** all_sq = (char **) malloc(all_sq_sz * sizeof(char*));
-  if(all_sq == NULL)
+  strcpy(in_file, argv[optind]);
+  k_mers = strtol(argv[optind + 1], NULL, 10);
+  strcpy(out_file, argv[optind + 2]);
+  if (k_mers < 1 || k_mers >= KEY_MAX_LENGTH)
     {
-      fprintf(stderr, "Calloc error while assigning memory to seq array\n");
+      fprintf(stderr, "ERROR - k_mers must be in [1, %d]\n", KEY_MAX_LENGTH - 1);
       exit(1);
     }
+  bloom_t seen;
+  if (bloom_mb > 0)
+    {
+      if (bloom_init(&seen, bloom_mb << 20) != BLOOM_OK)
+	{
+	  fprintf(stderr, "Error allocating the Bloom filter\n");
+	  exit(1);
+	}
+      filter = &seen;
+    }
+  cmsketch_t cms;
+  if (use_sketch)
+    {
+      if (cmsketch_init(&cms, sketch_width, sketch_depth) != CMSKETCH_OK)
+	{
+	  fprintf(stderr, "Error allocating the sketch\n");
+	  exit(1);
+	}
+      sketch = &cms;
+    }
+  narrow = (k_mers <= KMER_MAX_K);
+  wide = !narrow && (k_mers <= WKMER_MAX_K);
+  wide_k = k_mers;
   
-  /* Open file to load a sequence */
-  FILE *infp = fopen(in_file, "r");
-  int n_seq = 0;
-  
-  while (fgets(temp_buf,MAX_LINE,infp) != NULL)
+  fasta_file_t infp;
+  fasta_seq_t* all_sq = NULL;
+  size_t n_seq = 0;
+  seqstore_t store;
+  int packed = 0;
+  if (stream)
     {
-      // check if line is a properties line (strating with '>')
-      if(temp_buf[0] == '>')
+      /* Count while reading, no sequence is kept in memory */
+    }
+  else if (cache || seqstore_map(&store, in_file) == SEQSTORE_OK)
+    {
+      /* Count from the packed cache of the file, written first with
+	 --cache when it is not up to date */
+      packed = 1;
+      if (cache)
 	{
-	  if(n_seq > 0)
+	  if (seqstore_load(&store, in_file, nthreads) != SEQSTORE_OK)
 	    {
-#             ifdef DEBUG  
-	      printf("Sequence %d of size %ld is %s \n", n_seq, sq_len, sq_buffer);
-#             endif
-	      all_sq[n_seq - 1] = (char*) malloc ((sq_len + 1)*sizeof(char));
-	      if(all_sq[n_seq - 1] == NULL)
-		{
-		  fprintf(stderr, "Malloc error while assigning memory to sq char\n");
-		  exit(1);
-		}
-	      strcpy(all_sq[n_seq - 1], sq_buffer);
-	      if ( n_seq % MAX_SQ == 0)
-		{
-		  all_sq_sz += MAX_SQ;
-		  all_sq = realloc(all_sq,(all_sq_sz*sizeof(char*)));
-		  if(all_sq == NULL)
-		    {
-		      fprintf(stderr, "Realloc error while re-assigning memory to sq array\n");
-		      exit(1);
-		    }
-		}		   		
+	      fprintf(stderr, "Error loading in file\n");
+	      exit(1);
 	    }
-	  strcpy(sq_buffer,"");
-	  sq_len = 0;
-	  n_seq++;
-	  continue; 
+	  if (store.map == NULL
+	      && seqstore_save(&store, in_file) != SEQSTORE_OK)
+	    fprintf(stderr, "Warning - could not write %s%s\n", in_file,
+		    SEQSTORE_EXT);
 	}
-      // to not include newline char
-      ln_len = strlen(temp_buf) - 1;
-      sq_len += ln_len; 
-      strncat(sq_buffer, temp_buf, ln_len);
-      
-      //sq_len = strlen(sq_buffer);
-
-    } // End While
-  
-      // save last sequence
-# ifdef DEBUG  
-  printf("Sequence %d of size %ld is %s \n", n_seq, sq_len, sq_buffer);
-# endif
-  all_sq[n_seq - 1] = (char*) malloc ((sq_len + 1)*sizeof(char));
-  strcpy(all_sq[n_seq - 1], sq_buffer);
-  if ( n_seq % MAX_SQ == 0)
+    }
+  else
     {
-      all_sq_sz += MAX_SQ;
-      all_sq = (char **) realloc (all_sq, (all_sq_sz*sizeof(char*)));
-    }		  
-  fclose(infp);
+      /* Map the file and index its sequences */
+      if (fasta_open(&infp, in_file) != FASTA_OK)
+	{
+	  fprintf(stderr, "Error opening in file\n");
+	  exit(1);
+	}
+      if (fasta_index_parallel(&infp, nthreads, &all_sq, &n_seq) != FASTA_OK)
+	{
+	  fprintf(stderr, "Calloc error while assigning memory to seq array\n");
+	  exit(1);
+	}
+    }
+
+  /* Estimate the distinct k-mers in a first pass, over every
+     record_step-th record */
+  double distinct = 0;
+  if (stream && estimate && strcmp(in_file, "-") == 0)
+    {
+      fprintf(stderr, "Warning - the standard input cannot be read twice, no estimate\n");
+      estimate = 0;
+    }
+  if (estimate)
+    {
+      hll_t hll;
+      if (hll_init(&hll, HLL_BITS) != HLL_OK)
+	{
+	  fprintf(stderr, "Error allocating the estimator\n");
+	  exit(1);
+	}
+      record_step = (sample_pct > 0 && sample_pct < 100)
+	? (size_t) (100 / sample_pct + 0.5) : 1;
+      estimator = &hll;
+      gettimeofday(&t1, NULL);
+      process_input (in_file, stream, packed ? &store : NULL, all_sq, n_seq,
+		     k_mers);
+      gettimeofday(&t2, NULL);
+      estimator = NULL;
+      // a sample of the records gives an upper bound
+      double err = hll_error(&hll);
+      distinct = hll_estimate(&hll) * record_step;
+      printf("Estimated %.0f distinct %d-mers (+/- %.1f%%) in %5.3f ms\n",
+	     distinct, k_mers, 100 * err,
+	     (t2.tv_sec - t1.tv_sec) * 1000.0
+	     + (t2.tv_usec - t1.tv_usec) / 1000.0);
+      hll_free(&hll);
+      record_step = 1;
+      if (estimate_only)
+	return 0;
+      // the filter keeps singletons out of the map, the sketch has none
+      if (filter != NULL || sketch != NULL)
+	distinct = 0;
+      else
+	distinct *= 1 + 3 * err;
+    }
+
+  /* Maps sized for the estimate, not to grow while counting */
+  if (narrow)
+    {
+      if (kmap_init_size(&narrowmap, (size_t) distinct) != MAP_OK)
+	{
+	  fprintf(stderr, "Error allocating the k-mer map\n");
+	  exit(1);
+	}
+    }
+  else if (wide)
+    {
+      if (wkmap_init_size(&widemap, wkmer_words(k_mers), (size_t) distinct)
+	  != MAP_OK)
+	{
+	  fprintf(stderr, "Error allocating the k-mer map\n");
+	  exit(1);
+	}
+    }
+  else
+    mymap = hashmap_new_values(distinct < INT_MAX / 2 ? (int) distinct
+			       : INT_MAX / 2, offsetof(mapent_t, key_string));
 
-  // process all sequences
   gettimeofday(&t1, NULL);
-  process_all_sq (all_sq, n_seq, k_mers);
+  process_input (in_file, stream, packed ? &store : NULL, all_sq, n_seq,
+		 k_mers);
   gettimeofday(&t2, NULL);
   elapsedTime = (t2.tv_sec - t1.tv_sec) * 1000.0;      // sec to ms
   elapsedTime += (t2.tv_usec - t1.tv_usec) / 1000.0;   // us to ms}
@@ -144,52 +374,468 @@ int main(int argc, char *argv[])
   
   // create an output file
   FILE *outfp = fopen(out_file, "w");
-  hashmap_iterate(mymap, &printent, outfp);
+  if (outfp == NULL)
+    {
+      fprintf(stderr, "Error opening out file\n");
+      exit(1);
+    }
+  if (sketch != NULL)
+    {
+      printf("Count-Min sketch of %" PRIu64 " x %d counters (%.1f MB): estimates at most %.1f over the count with probability %.3f\n",
+	     sketch->width, sketch->depth,
+	     sketch->width * sketch->depth * sizeof(uint32_t) / 1048576.0,
+	     cmsketch_error(sketch), cmsketch_confidence(sketch));
+      int i;
+      for (i = 0; i < n_queries; i++)
+	query_sketch (outfp, queries[i], k_mers);
+      if (query_file != NULL)
+	{
+	  // one k-mer per line
+	  char line[KEY_MAX_LENGTH + 2];
+	  FILE* qfp = fopen(query_file, "r");
+	  if (qfp == NULL)
+	    {
+	      fprintf(stderr, "Error opening query file\n");
+	      exit(1);
+	    }
+	  while (fgets(line, sizeof(line), qfp) != NULL)
+	    {
+	      line[strcspn(line, "\r\n")] = '\0';
+	      if (line[0] != '\0')
+		query_sketch (outfp, line, k_mers);
+	    }
+	  fclose(qfp);
+	}
+      cmsketch_free(sketch);
+    }
+  else if (narrow)
+    kmap_iterate(&narrowmap, &printnarrow, outfp);
+  else if (wide)
+    wkmap_iterate(&widemap, &printwide, outfp);
+  else
+    hashmap_iterate(mymap, &printent, outfp);
   fclose(outfp);
+  if (packed)
+    seqstore_free(&store);
+  else if (!stream)
+    {
+      free(all_sq);
+      fasta_close(&infp);
+    }
+  if (filter != NULL)
+    bloom_free(filter);
   // Destroy the map 
-  hashmap_free(mymap);
+  if (narrow)
+    kmap_free(&narrowmap);
+  else if (wide)
+    wkmap_free(&widemap);
+  else
+    hashmap_free(mymap);
   return 0;
 }
 
-void process_all_sq (char** all, size_t sq_num, int k_mers)
+/*
+ * Count the k-mers of the input once: streamed from in_file, or from
+ * the packed store if not NULL, or from the records all_sq.
+ */
+void process_input (const char* in_file, int stream, const seqstore_t* store,
+		    fasta_seq_t* all_sq, size_t n_seq, int k_mers)
 {
-  int i, j, sq_len;
-  for(i = 0; i < sq_num; i++)
+  if (stream)
     {
-      sq_len = strlen(all[i]);
-      char sub_sq[k_mers + 1]; // including '\0' char
-      for(j = 0; j <= sq_len - k_mers; j++)
+      fasta_stream_t instr;
+      if (fasta_stream_open(&instr, in_file, STREAM_BUF) != FASTA_OK)
 	{
-	  memcpy(sub_sq, &all[i][j], k_mers);
-	  sub_sq[k_mers] = '\0';
+	  fprintf(stderr, "Error opening in file\n");
+	  exit(1);
+	}
+      process_stream (&instr, k_mers);
+      fasta_stream_close(&instr);
+    }
+  else if (store != NULL)
+    process_all_store (store, k_mers);
+  else
+    process_all_sq (all_sq, n_seq, k_mers);
+}
 
-	  mapent_t* value; // = malloc(sizeof(data_struct_t));
-	  if (hashmap_get(mymap, sub_sq, (void**)(&value)) == MAP_MISSING)
-	    {
-	      //printf("Map missing \n");
-	      value = malloc(sizeof(mapent_t));
-	      strcpy(value->key_string, sub_sq);
-	      value->number=1;
-	      int error = hashmap_put(mymap, value->key_string, value);
-	      assert(error==MAP_OK);
-	    }
-	  else
-	    {
-	      //printf("Map ok\n");
-	      value->number++;
-	    }	  
-	  //size_t in = get_index(sub_sq, k_mers);
-	  //histogram[in]++;
-#     ifdef DEBUG
-	  printf("sub sq %s , index = 0x%.8lX \n",sub_sq, in);
-#     endif
-	} 
+void process_all_sq (fasta_seq_t* all, size_t sq_num, int k_mers)
+{
+  size_t i;
+  int filled;
+  char sub_sq[k_mers + 1], sub_rc[k_mers + 1]; // including '\0' char
+  wkmer_roll_t roll;
+  kmer_roll_t kroll;
+  sub_sq[k_mers] = sub_rc[k_mers] = '\0';
+  wkmer_roll_init(&roll, k_mers);
+  kmer_roll_init(&kroll, k_mers, canonical ? KMER_CANONICAL : KMER_FORWARD);
+  for(i = 0; i < sq_num; i += record_step)
+    {
+      filled = roll.filled = 0;
+      kmer_roll_reset(&kroll);
+      if (narrow)
+	process_narrow_sq (&all[i], &kroll);
+      else if (wide)
+	process_wide_sq (&all[i], &roll);
+      else
+	process_sq (&all[i], k_mers, sub_sq, sub_rc, &filled);
     } 
 }
 
+void process_stream (fasta_stream_t* in, int k_mers)
+{
+  int filled = 0, new_record, err;
+  size_t records = 0;
+  fasta_seq_t chunk;
+  char sub_sq[k_mers + 1], sub_rc[k_mers + 1]; // including '\0' char
+  wkmer_roll_t roll;
+  kmer_roll_t kroll;
+  sub_sq[k_mers] = sub_rc[k_mers] = '\0';
+  wkmer_roll_init(&roll, k_mers);
+  kmer_roll_init(&kroll, k_mers, canonical ? KMER_CANONICAL : KMER_FORWARD);
+  // the window (sub_sq, roll or kroll, filled) carries the last
+  // k_mers - 1 bases from one chunk to the next, it only restarts on a
+  // new record, and only one record in record_step is read
+  while ((err = fasta_stream_next(in, &chunk, &new_record)) == FASTA_OK)
+    {
+      if(new_record)
+	{
+	  records++;
+	  filled = roll.filled = 0;
+	  kmer_roll_reset(&kroll);
+	}
+      if ((records - 1) % record_step != 0)
+	continue;
+      if (narrow)
+	process_narrow_sq (&chunk, &kroll);
+      else if (wide)
+	process_wide_sq (&chunk, &roll);
+      else
+	process_sq (&chunk, k_mers, sub_sq, sub_rc, &filled);
+    }
+  if (err == FASTA_ERR)
+    {
+      fprintf(stderr, "Error reading in file\n");
+      exit(1);
+    }
+}
+
+/*
+ * Shift the base b into the window sub_sq, whose first *filled bases
+ * are already loaded, and count the k-mer it completes. In canonical
+ * mode sub_rc is the reverse complement of the window, it slides the
+ * other way: each base enters complemented at the front.
+ */
+static inline void count_base (int b, int k_mers, char* sub_sq, char* sub_rc,
+			       int* filled)
+{
+  static const char complement[4] = {'T', 'G', 'C', 'A'};
+  char* key;
+  // a window holding an invalid base (N, ...) is never completed
+  if(kmer_code[b] == KMER_INVALID)
+    {
+      *filled = 0;
+      return;
+    }
+  memmove(sub_sq, sub_sq + 1, k_mers - 1);
+  sub_sq[k_mers - 1] = toupper(b);
+  if(canonical)
+    {
+      memmove(sub_rc + 1, sub_rc, k_mers - 1);
+      sub_rc[0] = complement[kmer_code[b]];
+    }
+  if(*filled < k_mers)
+    if(++(*filled) < k_mers)
+      return;
+  key = sub_sq;
+  if(canonical && memcmp(sub_rc, sub_sq, k_mers) < 0)
+    key = sub_rc;
+  if(estimator != NULL)
+    {
+      hll_add(estimator, bloom_hash_bytes(key, k_mers));
+      return;
+    }
+  if(sketch != NULL)
+    {
+      cmsketch_add(sketch, bloom_hash_bytes(key, k_mers));
+      return;
+    }
+
+  // with the filter, a k-mer is only stored once seen twice: one the
+  // filter has not seen cannot be in the map either
+  if (filter != NULL && !bloom_add(filter, bloom_hash_bytes(key, k_mers)))
+    return;
+  mapent_t* value;
+  switch (hashmap_upsert(mymap, key, k_mers, (any_t*)(&value)))
+    {
+    case MAP_OK:
+      value->number++;
+      break;
+    case MAP_MISSING:
+      value->number = (filter != NULL) ? 2 : 1;
+      break;
+    default:
+      fprintf(stderr, "Error allocating the k-mer map\n");
+      exit(1);
+    }
+# ifdef DEBUG
+  printf("sub sq %s \n",key);
+# endif
+}
+
+/*
+ * Count the k-mers of a sequence (or a piece of it) continuing the
+ * window sub_sq.
+ */
+void process_sq (const fasta_seq_t* sq, int k_mers, char* sub_sq, char* sub_rc,
+		 int* filled)
+{
+  int b;
+  fasta_cursor_t cur;
+  // slide a k_mers window over the bases, across line breaks
+  fasta_cursor_init(&cur, sq);
+  while((b = fasta_cursor_next(&cur)) >= 0)
+    count_base (b, k_mers, sub_sq, sub_rc, filled);
+}
+
+/*
+ * Shift the base b into the window of r and count the k-mer it
+ * completes with a packed key. Inlined for each key width.
+ */
+static inline __attribute__((always_inline))
+void wide_base (int b, wkmer_roll_t* r, const int words)
+{
+  const uint64_t* key;
+  if(!wkmer_roll(r, b, words))
+    return;
+  key = r->fwd;
+  if(canonical && wkmer_cmp(r->rev, r->fwd, words) < 0)
+    key = r->rev;
+  if (estimator != NULL)
+    {
+      hll_add(estimator, bloom_hash_words(key, words));
+      return;
+    }
+  if (sketch != NULL)
+    {
+      cmsketch_add(sketch, bloom_hash_words(key, words));
+      return;
+    }
+  if (filter != NULL)
+    {
+      // with the filter, a k-mer is only stored once seen twice
+      uint64_t* count = wkmap_count(&widemap, key);
+      if (count != NULL)
+	{
+	  (*count)++;
+	  return;
+	}
+      if (!bloom_add(filter, bloom_hash_words(key, words)))
+	return;
+      if (wkmap_add_n(&widemap, key, 2) == MAP_OK)
+	return;
+    }
+  else if (wkmap_add(&widemap, key) == MAP_OK)
+    return;
+  fprintf(stderr, "Error allocating the k-mer map\n");
+  exit(1);
+}
+
+static inline __attribute__((always_inline))
+void wide_sq (const fasta_seq_t* sq, wkmer_roll_t* r, const int words)
+{
+  int b;
+  fasta_cursor_t cur;
+  fasta_cursor_init(&cur, sq);
+  while((b = fasta_cursor_next(&cur)) >= 0)
+    wide_base (b, r, words);
+}
+
+/*
+ * Count the k-mers of a sequence (or a piece of it) with packed keys,
+ * continuing the window of r.
+ */
+void process_wide_sq (const fasta_seq_t* sq, wkmer_roll_t* r)
+{
+  if(r->words == 2)
+    wide_sq (sq, r, 2);
+  else
+    wide_sq (sq, r, 4);
+}
+
+static inline __attribute__((always_inline))
+void wide_store (seqstore_cursor_t* cur, wkmer_roll_t* r, const int words)
+{
+  int b;
+  while((b = seqstore_cursor_next(cur)) >= 0)
+    wide_base (b, r, words);
+}
+
+/*
+ * Count the n k-mer indexes at "in" (k_mers <= KMER_MAX_K) in the
+ * narrow map, as wide_base does for one packed key.
+ */
+static void count_keys (const uint64_t* in, long n)
+{
+  long j;
+  if (estimator != NULL)
+    {
+      for (j = 0; j < n; j++)
+	hll_add(estimator, bloom_hash_words(&in[j], 1));
+      return;
+    }
+  if (sketch != NULL)
+    {
+      for (j = 0; j < n; j++)
+	cmsketch_add(sketch, bloom_hash_words(&in[j], 1));
+      return;
+    }
+  for (j = 0; j < n; j++)
+    {
+      if (filter != NULL)
+	{
+	  // with the filter, a k-mer is only stored once seen twice
+	  if (kmap_inc(&narrowmap, in[j])
+	      || !bloom_add(filter, bloom_hash_words(&in[j], 1)))
+	    continue;
+	  if (kmap_add_n(&narrowmap, in[j], 2) == MAP_OK)
+	    continue;
+	}
+      else if (kmap_add(&narrowmap, in[j]) == MAP_OK)
+	continue;
+      fprintf(stderr, "Error allocating the k-mer map\n");
+      exit(1);
+    }
+}
+
+/*
+ * Count the k-mers of a sequence (or a piece of it) by index,
+ * continuing the window of r.
+ */
+void process_narrow_sq (const fasta_seq_t* sq, kmer_roll_t* r)
+{
+  long n;
+  uint64_t in[KMER_BATCH];
+  fasta_cursor_t cur;
+  fasta_cursor_init(&cur, sq);
+  while((n = kmer_batch(r, &cur, in)) >= 0)
+    count_keys (in, n);
+}
+
+/*
+ * Same as process_all_sq, over the records of a packed store.
+ */
+void process_all_store (const seqstore_t* store, int k_mers)
+{
+  size_t i;
+  int b, filled;
+  long n;
+  char sub_sq[k_mers + 1], sub_rc[k_mers + 1]; // including '\0' char
+  uint64_t in[KMER_BATCH];
+  wkmer_roll_t roll;
+  kmer_roll_t kroll;
+  seqstore_cursor_t cur;
+  sub_sq[k_mers] = sub_rc[k_mers] = '\0';
+  wkmer_roll_init(&roll, k_mers);
+  kmer_roll_init(&kroll, k_mers, canonical ? KMER_CANONICAL : KMER_FORWARD);
+  for(i = 0; i < store->n_seq; i += record_step)
+    {
+      filled = roll.filled = 0;
+      kmer_roll_reset(&kroll);
+      seqstore_cursor_init(&cur, store, i);
+      if (narrow)
+	while((n = kmer_store_batch(&kroll, &cur, in)) >= 0)
+	  count_keys (in, n);
+      else if (!wide)
+	while((b = seqstore_cursor_next(&cur)) >= 0)
+	  count_base (b, k_mers, sub_sq, sub_rc, &filled);
+      else if (roll.words == 2)
+	wide_store (&cur, &roll, 2);
+      else
+	wide_store (&cur, &roll, 4);
+    }
+}
+
 int printent(void* fd, void* data)
 {
   //printf("printing\n");
+  if (((mapent_t*)data)->number < min_count)
+    return MAP_OK;
   fprintf((FILE *)fd,"%s\t%d\n", ((mapent_t*)data)->key_string, ((mapent_t*)data)->number);
   return MAP_OK;
 }
+
+int printnarrow(void* fd, uint64_t key, uint64_t count)
+{
+  char str[KMER_MAX_K + 1];
+  if (count < min_count)
+    return MAP_OK;
+  wkmer_string(str, &key, wide_k);
+  fprintf((FILE *)fd, "%s\t%" PRIu64 "\n", str, count);
+  return MAP_OK;
+}
+
+int printwide(void* fd, const uint64_t* key, uint64_t count)
+{
+  char str[WKMER_MAX_K + 1];
+  if (count < min_count)
+    return MAP_OK;
+  wkmer_string(str, key, wide_k);
+  fprintf((FILE *)fd, "%s\t%" PRIu64 "\n", str, count);
+  return MAP_OK;
+}
+
+/*
+ * Write the estimate of the sketch for kmer, hashed as it is when
+ * counted: packed, or as an upper case string.
+ */
+void query_sketch (FILE* outfp, const char* kmer, int k_mers)
+{
+  static const char complement[4] = {'T', 'G', 'C', 'A'};
+  char sub_sq[KEY_MAX_LENGTH], sub_rc[KEY_MAX_LENGTH];
+  const char* key;
+  uint64_t h;
+  wkmer_roll_t r;
+  uint64_t x;
+  int i, full = 0;
+  if (strlen(kmer) != k_mers)
+    {
+      fprintf(stderr, "Warning - %s is not a %d-mer\n", kmer, k_mers);
+      return;
+    }
+  if (narrow)
+    {
+      full = kmer_encode(kmer, k_mers, &x);
+      if (canonical)
+	x = kmer_canonical(x, k_mers);
+      h = bloom_hash_words(&x, 1);
+    }
+  else if (wide)
+    {
+      wkmer_roll_init(&r, k_mers);
+      for (i = 0; i < k_mers; i++)
+	full = wkmer_roll(&r, kmer[i], r.words);
+      if (canonical && wkmer_cmp(r.rev, r.fwd, r.words) < 0)
+	h = bloom_hash_words(r.rev, r.words);
+      else
+	h = bloom_hash_words(r.fwd, r.words);
+    }
+  else
+    {
+      for (i = 0, full = 1; i < k_mers; i++)
+	{
+	  full = full && kmer_code[(unsigned char) kmer[i]] != KMER_INVALID;
+	  sub_sq[i] = toupper(kmer[i]);
+	  sub_rc[k_mers - 1 - i] = complement[kmer_code[(unsigned char) kmer[i]] & 3];
+	}
+      key = sub_sq;
+      if (canonical && memcmp(sub_rc, sub_sq, k_mers) < 0)
+	key = sub_rc;
+      h = bloom_hash_bytes(key, k_mers);
+    }
+  if (!full)
+    {
+      fprintf(stderr, "Warning - %s is not a %d-mer\n", kmer, k_mers);
+      return;
+    }
+  fprintf(outfp, "%s\t%u\n", kmer, cmsketch_query(sketch, h));
+}
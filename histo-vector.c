@@ -6,8 +6,84 @@
  *  This program creates an histogram form a "fna" or "fasta" file 
  *  using a vector to represent the histogram array.  
  *  
- *  Compile: gcc -Wall -o histo-vector histo-vector.c -lm
+ *  Compile: gcc -Wall -o histo-vector histo-vector.c fasta.c kmer.c nucpack.c \
+ *               seqstore.c radix.c kmsort.c ccount.c kmbin.c hugemem.c \
+ *               kmstat.c \
+ *               -lm -pthread
  *  Usage: ./histo-vector Test_Bancomini.fna 15 out.dat
+ *         ./histo-vector --stream - 15 out.dat < Test_Bancomini.fna
+ *         ./histo-vector Test_Bancomini.fna 11,13,15 out.dat
+ *
+ *  k_mers can be a list of up to 8 values: one scan of the input
+ *  counts all of them, the k-mers of each smaller k taken from the
+ *  window of the largest one, and the histogram of k goes to
+ *  <outfile>.k<k>. Each k has its own vector; --engine sort, --max-mem
+ *  passes and --bins cannot be used then, and --threads only index
+ *  and pack the input.
+ *
+ *  Options:
+ *    -s, --stream   count k-mers while the input is read through a fixed
+ *                   size buffer, memory use does not depend on input size
+ *    -t, --threads  number of threads parsing and counting the input
+ *                   (default 1)
+ *    -S, --split    how --threads threads share the counting (not with
+ *                   --stream): "seqs", each thread counts a part of the
+ *                   sequences in a private vector, then the vectors are
+ *                   summed in parallel; "range", each thread reads all
+ *                   the sequences and counts the k-mers of its own
+ *                   index range. Default: seqs up to k_mers = 12, range
+ *                   above, where private vectors get too large
+ *    -c, --canonical  count each k-mer together with its reverse
+ *                   complement, reported as the smaller of both; for odd
+ *                   k the vector holds only pow(4, k_mers) / 2 entries
+ *    -p, --packed   pack the sequences 2 bits per base in a seqstore
+ *                   first (with --threads threads) and count from it
+ *    -C, --cache    also save the packed sequences in <file>.sqs; while
+ *                   <file> is not modified, later runs (of any driver)
+ *                   map that cache instead of parsing the text
+ *
+ *    -e, --engine   how k-mers are counted: "direct", one increment of
+ *                   the vector per k-mer; "radix", buffered by slice of
+ *                   the vector and added slice by slice (radix.h);
+ *                   "sort", no vector: the k-mers are sorted and
+ *                   run-length counted (kmsort.h), for k_mers too large
+ *                   for a vector. --threads threads sort. Default: sort
+ *                   above 2^32 entries, radix from 2^24, direct below
+ *    -m, --mem      MB of k-mers sorted per batch by the sort engine
+ *                   with --stream (default 1024); without --stream all
+ *                   the k-mers of the input are sorted at once
+ *    -w, --width    bits of a counter of the vector: 8, 16 or 32
+ *                   (default). Counts a counter cannot hold spill into
+ *                   a side table (ccount.h), the output is the same
+ *    -M, --max-mem  MB of the vector (of all the private vectors with
+ *                   --split seqs): a larger index space is counted in
+ *                   passes over the input, one index range per pass
+ *                   in the same vector, each range appended to the
+ *                   output. With --stream the file is read once per
+ *                   pass, it cannot be "-". Past 32 passes the k-mers
+ *                   are sorted in memory instead. Not used by the sort
+ *                   engine
+ *
+ *    -b, --bins     out of core: the k-mers read are first written to
+ *                   this many files (rounded up to a power of 2), one
+ *                   per range of indexes (kmbin.h), then each file is
+ *                   counted in memory in turn, with a vector of one
+ *                   range or the sort engine. The input is read once,
+ *                   through the --stream buffer
+ *    -T, --tmp      directory of the bin files (default: $TMPDIR, or
+ *                   /tmp)
+ *    -B, --io-buf   KB buffered per bin before it is written (default
+ *                   1024)
+ *    -P, --pages    pages of the vector from 2 MB on (hugemem.h): "huge"
+ *                   (default), from the huge page pool or transparent
+ *                   huge pages; "normal", 4 KB pages, to compare
+ *
+ *    -A, --spectrum instead of the counts of the k-mers, write how many
+ *                   k-mers have each count, "count k-mers" by
+ *                   increasing count (kmstat.h)
+ *    -N, --top      instead of the counts of the k-mers, write the N
+ *                   most abundant ones, by decreasing count (smaller
+ *                   k-mer first among equal counts)
  *
  *   \Author: Danny Múnera - Parallel Programing UdeA 
  */
@@ -17,208 +93,1257 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "fasta.h"
+#include "kmer.h"
+#include "seqstore.h"
+#include "radix.h"
+#include "kmsort.h"
+#include "ccount.h"
+#include "kmbin.h"
+#include "hugemem.h"
+#include "kmstat.h"
+
+#define STREAM_BUF (1 << 20)
+
+/* --engine counting engines */
+#define ENGINE_DIRECT 0   /* histogram[index]++ */
+#define ENGINE_RADIX 1    /* radix-partitioned buffers */
+#define ENGINE_SORT 2     /* sort and count, no vector */
+#define RADIX_MIN_ENT (1LL << 24)   /* smallest vector counted with radix */
+#define DENSE_MAX_ENT (1LL << 32)   /* largest vector allocated by default */
+#define SORT_MEM 1024               /* default --mem */
+#define MAX_PASSES 32               /* the sort engine does better past this */
+#define BIN_BUF 1024                /* default --io-buf */
+
+/* --split strategies */
+#define SPLIT_SEQS 0    /* records split among threads, vectors merged */
+#define SPLIT_RANGE 1   /* index range split among threads */
+#define SPLIT_MAX_K 12  /* largest k_mers split by records by default */
+
+/*
+ * Histograms of the values of k counted in the same scan, k-mer j in
+ * histogram[j], through the buffers rc[j] when not NULL.
+ */
+typedef struct multi_count_s
+{
+  kmer_multi_t enc;
+  ccount_t histogram[KMER_MAX_MULTI];
+  radix_count_t radix[KMER_MAX_MULTI];
+  radix_count_t* rc[KMER_MAX_MULTI];
+} multi_count_t;
 
-#define MAX_SQ 5000
-#define MAX_LINE 1000
+/*
+ * Work of one counting thread: the k-mers of records [lo, hi) (of the
+ * text views "all" or of the packed "store") with an index in
+ * [low, high), counted in histogram. Merge threads add the indexes
+ * [low, high) of the nparts vectors "parts" to histogram.
+ */
+typedef struct count_job_s
+{
+  const fasta_seq_t* all;
+  const seqstore_t* store;
+  size_t lo, hi;
+  long long low, high;
+  int k_mers, mode;
+  ccount_t* histogram;
+  ccount_t* parts;
+  int nparts;
+  int running;
+  pthread_t tid;
+} count_job_t;
 
 //#define DEBUG
 
-void process_all_sq (char** all, size_t sq_num, int k_mers, unsigned int* histogram);
-void get_index(char* sq, size_t sz, long long * index);
+// Counting engine
+int engine = -1;
+// Counter of the sort engine
+kmsort_t sorter;
+// Index range [pass_low, pass_low + histogram->n_ent) counted in this
+// pass, when there are several
+long long passes = 1, pass_low = 0;
+// Bins the k-mers go to, while they are written out of core
+kmbin_t* binner = NULL;
+// Summaries written instead of the counts, when asked
+kmstat_spectrum_t* spectrum = NULL;
+kmstat_top_t* top = NULL;
+
+void process_all_sq (fasta_seq_t* all, size_t sq_num, int k_mers, int mode,
+		     ccount_t* histogram);
+void process_all_store (const seqstore_t* store, int k_mers, int mode,
+			ccount_t* histogram);
+void process_parallel (const fasta_seq_t* all, const seqstore_t* store,
+		       size_t sq_num, int k_mers, int mode,
+		       ccount_t* histogram, int nthreads, int split);
+void process_stream (fasta_stream_t* in, int k_mers, int mode,
+		     ccount_t* histogram);
+void process_sq (const fasta_seq_t* sq, kmer_roll_t* roll,
+		 ccount_t* histogram, radix_count_t* rc);
+void process_bins (const char* in_file, int k_mers, int mode,
+		   ccount_t* histogram, const char* tmp, int n_bins,
+		   size_t buf_bytes, int nthreads, FILE* outfp);
+void process_multi (const char* in_file, int stream, int packed, int cache,
+		    int nthreads, const int* ks, int n_k, int canonical,
+		    int width, const char* out_file);
+void multi_sq (multi_count_t* mc, const fasta_seq_t* sq);
+int parse_k_list (const char* arg, int* ks);
+void sort_start (size_t n_kmers, int k_mers, int nthreads);
+int print_sorted (void* item, uint64_t index, unsigned int count);
+void print_counts (FILE* outfp, ccount_t* histogram, int k_mers, int mode);
+void print_report (FILE* outfp, int k_mers);
+void start_pass (ccount_t* histogram, long long p);
+void end_pass (FILE* outfp, ccount_t* histogram, int k_mers, int mode);
+double lap (const struct timeval* t1);
 void get_char(char* sq, size_t sz, long long index);
   
+static struct option long_opts[] = {
+  {"stream", no_argument, NULL, 's'},
+  {"threads", required_argument, NULL, 't'},
+  {"canonical", no_argument, NULL, 'c'},
+  {"packed", no_argument, NULL, 'p'},
+  {"cache", no_argument, NULL, 'C'},
+  {"split", required_argument, NULL, 'S'},
+  {"engine", required_argument, NULL, 'e'},
+  {"mem", required_argument, NULL, 'm'},
+  {"width", required_argument, NULL, 'w'},
+  {"max-mem", required_argument, NULL, 'M'},
+  {"bins", required_argument, NULL, 'b'},
+  {"tmp", required_argument, NULL, 'T'},
+  {"io-buf", required_argument, NULL, 'B'},
+  {"pages", required_argument, NULL, 'P'},
+  {"spectrum", no_argument, NULL, 'A'},
+  {"top", required_argument, NULL, 'N'},
+  {NULL, 0, NULL, 0}
+};
+
 int main(int argc, char *argv[])
 {
-  if (argc != 4)
+  int opt, stream = 0, nthreads = 1, canonical = 0, packed = 0, cache = 0;
+  int split = -1;
+  long long mem = SORT_MEM;
+  int width = 32;
+  long long max_mem = 0, io_buf = BIN_BUF;
+  int n_bins = 0;
+  const char* tmp = getenv("TMPDIR");
+  int want_spectrum = 0;
+  long long top_n = -1;
+  kmstat_spectrum_t spec;
+  kmstat_top_t best;
+  while ((opt = getopt_long(argc, argv, "st:cpCS:e:m:w:M:b:T:B:P:AN:",
+			    long_opts, NULL))
+	 != -1)
+    {
+      switch (opt) {
+      case 's':
+	stream = 1;
+	break;
+      case 't':
+	nthreads = strtol(optarg, NULL, 10);
+	break;
+      case 'c':
+	canonical = 1;
+	break;
+      case 'p':
+	packed = 1;
+	break;
+      case 'C':
+	cache = 1;
+	break;
+      case 'S':
+	if (strcmp(optarg, "seqs") == 0)
+	  split = SPLIT_SEQS;
+	else if (strcmp(optarg, "range") == 0)
+	  split = SPLIT_RANGE;
+	else
+	  argc = 0;
+	break;
+      case 'e':
+	if (strcmp(optarg, "direct") == 0)
+	  engine = ENGINE_DIRECT;
+	else if (strcmp(optarg, "radix") == 0)
+	  engine = ENGINE_RADIX;
+	else if (strcmp(optarg, "sort") == 0)
+	  engine = ENGINE_SORT;
+	else
+	  argc = 0;
+	break;
+      case 'm':
+	mem = strtoll(optarg, NULL, 10);
+	break;
+      case 'w':
+	width = strtol(optarg, NULL, 10);
+	if (width != 8 && width != 16 && width != 32)
+	  argc = 0;
+	break;
+      case 'M':
+	max_mem = strtoll(optarg, NULL, 10);
+	break;
+      case 'b':
+	n_bins = strtol(optarg, NULL, 10);
+	break;
+      case 'T':
+	tmp = optarg;
+	break;
+      case 'B':
+	io_buf = strtoll(optarg, NULL, 10);
+	break;
+      case 'P':
+	if (strcmp(optarg, "huge") == 0)
+	  hugemem_pages = HUGEMEM_HUGE;
+	else if (strcmp(optarg, "normal") == 0)
+	  hugemem_pages = HUGEMEM_NORMAL;
+	else
+	  argc = 0;
+	break;
+      case 'A':
+	want_spectrum = 1;
+	break;
+      case 'N':
+	top_n = strtoll(optarg, NULL, 10);
+	if (top_n < 1)
+	  argc = 0;
+	break;
+      default:
+	argc = 0; // print usage
+	break;
+      }
+    }
+  if (argc - optind != 3)
     {
-      fprintf(stderr, "ERROR - usage: histo <file> k_mers <outfile>\n");
+      fprintf(stderr, "ERROR - usage: histo [--stream] [--threads N] [--canonical] [--packed] [--cache] [--split seqs|range] [--engine direct|radix|sort] [--mem MB] [--width 8|16|32] [--max-mem MB] [--bins N] [--tmp DIR] [--io-buf KB] [--pages huge|normal] [--spectrum | --top N] <file> k_mers[,k_mers...] <outfile>\n");
       exit(1);
     }
   char in_file[200];
   char out_file[200];
-  int k_mers;
-  char sq_buffer[MAX_SQ], temp_buf[MAX_LINE];
-  size_t sq_len, ln_len, i;
+  int k_mers, ks[KMER_MAX_MULTI], n_k;
   struct timeval t1, t2;
   double elapsedTime;  
 
-  strcpy(in_file, argv[1]);
-  k_mers = strtol(argv[2], NULL, 10);
-  strcpy(out_file, argv[3]);
+  strcpy(in_file, argv[optind]);
+  n_k = parse_k_list(argv[optind + 1], ks);
+  strcpy(out_file, argv[optind + 2]);
+  if (n_k == 0)
+    {
+      fprintf(stderr, "ERROR - k_mers must be up to %d values in [1, %d]\n",
+	      KMER_MAX_MULTI, KMER_MAX_K - 1);
+      exit(1);
+    }
+  k_mers = ks[0];
   
-  // create vector
-  // using (8-bits)characters to keep the frequency of the histogram
-  long long max_ent = pow(4, k_mers);
-  unsigned int* histogram = (unsigned int*) calloc (max_ent,
-						    sizeof(unsigned int));
-  if(histogram == NULL)
+  if (nthreads < 1)
+    nthreads = 1;
+  if (want_spectrum && top_n > 0)
     {
-      fprintf(stderr, "Calloc error while assigning memory to vector\n");
+      fprintf(stderr, "ERROR - --spectrum and --top write to the same output, ask for one\n");
       exit(1);
     }
+  if (want_spectrum)
+    {
+      if (kmstat_spectrum_init(&spec) != KMSTAT_OK)
+	{
+	  fprintf(stderr, "Malloc error while assigning memory to spectrum\n");
+	  exit(1);
+	}
+      spectrum = &spec;
+    }
+  if (top_n > 0)
+    {
+      if (kmstat_top_init(&best, top_n) != KMSTAT_OK)
+	{
+	  fprintf(stderr, "Malloc error while assigning memory to top k-mers\n");
+	  exit(1);
+	}
+      top = &best;
+    }
+  if (n_k > 1)
+    {
+      if (engine == ENGINE_SORT || max_mem > 0 || n_bins > 0)
+	{
+	  fprintf(stderr, "ERROR - several k_mers are counted in vectors, without --max-mem or --bins\n");
+	  exit(1);
+	}
+      process_multi (in_file, stream, packed, cache, nthreads, ks, n_k,
+		     canonical, width, out_file);
+      return 0;
+    }
+  if (split < 0)
+    split = (k_mers <= SPLIT_MAX_K) ? SPLIT_SEQS : SPLIT_RANGE;
+  if (tmp == NULL || tmp[0] == '\0')
+    tmp = "/tmp";
 
-  // Data structure for sequences
-  int all_sq_sz = MAX_SQ;
-  char** all_sq = (char **) malloc(all_sq_sz * sizeof(char*));
-  if(all_sq == NULL)
+  // canonical k-mers of odd length have a dense index in half the space
+  int mode = KMER_FORWARD;
+  if (canonical)
+    mode = (k_mers % 2) ? KMER_CANONICAL_HALF : KMER_CANONICAL;
+
+  // create vector
+  // using (8, 16 or 32-bit) saturating counters, larger counts spill
+  // into a side table
+  long long max_ent = kmer_space(k_mers, mode);
+  int vectors = (nthreads > 1 && split == SPLIT_SEQS && !stream)
+    ? nthreads : 1;
+  // entries per vector under --max-mem: k-mer spaces from k = 31 on
+  // overflow once multiplied by the entry size
+  long long budget = (max_mem << 20) / ((width / 8) * vectors);
+  if (n_bins > 0)
+    {
+      // each bin counts a range of indexes, as a pass does
+      if (canonical)
+	mode = KMER_CANONICAL;
+      max_ent = kmer_space(k_mers, mode);
+      while (passes < n_bins && max_ent / passes > 1)
+	passes *= 2;
+    }
+  else if (max_mem > 0 && engine != ENGINE_SORT && max_ent > budget)
     {
-      fprintf(stderr, "Malloc error while assigning memory to seq array\n");
+      // each pass counts a range of indexes in index order: canonical
+      // k-mers keep the index of the smaller strand
+      if (canonical)
+	mode = KMER_CANONICAL;
+      max_ent = kmer_space(k_mers, mode);
+      while (passes < MAX_PASSES && max_ent / passes > 1
+	     && max_ent / passes > budget)
+	passes *= 2;
+      // more passes would each clear and scan a vector for little input:
+      // sort in memory instead
+      if (max_ent / passes > budget)
+	{
+	  if (engine < 0)
+	    {
+	      engine = ENGINE_SORT;
+	      passes = 1;
+	    }
+	  else
+	    fprintf(stderr, "Warning - %lld passes do not bring the vector under --max-mem\n", passes);
+	}
+    }
+  if (engine < 0)
+    engine = (max_ent / passes > DENSE_MAX_ENT) ? ENGINE_SORT
+      : (max_ent / passes >= RADIX_MIN_ENT) ? ENGINE_RADIX : ENGINE_DIRECT;
+  ccount_t counts, *histogram = NULL;
+  if (engine == ENGINE_SORT)
+    {
+      // sorted k-mers come out in index order, canonical ones as the
+      // smaller strand
+      if (canonical)
+	mode = KMER_CANONICAL;
+      max_ent = kmer_space(k_mers, mode);
+      // out of core only with --bins, each bin sorted in turn; else
+      // all the k-mers (or --mem of them with --stream) sorted in memory
+      if (n_bins > 0)
+	n_bins = passes;
+      passes = 1;
+    }
+  else if (ccount_init(&counts, max_ent / passes, width / 8) == CCOUNT_OK)
+    histogram = &counts;
+  else
+    {
+      fprintf(stderr, "Calloc error while assigning memory to vector\n");
       exit(1);
     }
-  
-  /* Open file to load a sequence */
-  FILE *infp = fopen(in_file, "r");
-  if (infp == NULL)
+  if (n_bins > 0)
+    n_bins = (histogram != NULL) ? passes : n_bins;
+  else if (passes > 1)
+    {
+      if (stream && strcmp(in_file, "-") == 0)
+	{
+	  fprintf(stderr, "ERROR - --max-mem needs %lld passes, the input cannot be read more than once\n", passes);
+	  exit(1);
+	}
+      printf("Counting in %lld passes of %lld entries\n", passes,
+	     histogram->n_ent);
+    }
+
+  // create an output file
+  FILE *outfp = fopen(out_file, "w");
+  if (outfp == NULL)
     {
       fprintf(stderr, "Error opening in file\n");
       exit(1);
     }
-  int n_seq = 0;
-  while (fgets(temp_buf,MAX_LINE,infp) != NULL)
+  long long p;
+  elapsedTime = 0;
+
+  if (n_bins > 0)
+    {
+      /* Write the k-mers to bins on disk, then count bin by bin */
+      gettimeofday(&t1, NULL);
+      process_bins (in_file, k_mers, mode, histogram, tmp, n_bins,
+		    io_buf << 10, nthreads, outfp);
+      elapsedTime += lap(&t1);
+    }
+  else if (stream)
+    {
+      /* Count while reading, no sequence is kept in memory */
+      fasta_stream_t instr;
+      if (engine == ENGINE_SORT)
+	sort_start ((mem << 20) / (2 * sizeof(uint64_t)), k_mers, nthreads);
+      for (p = 0; p < passes; p++)
+	{
+	  if (fasta_stream_open(&instr, in_file, STREAM_BUF) != FASTA_OK)
+	    {
+	      fprintf(stderr, "Error opening in file\n");
+	      exit(1);
+	    }
+	  start_pass (histogram, p);
+	  gettimeofday(&t1, NULL);
+	  process_stream (&instr, k_mers, mode, histogram);
+	  elapsedTime += lap(&t1);
+	  fasta_stream_close(&instr);
+	  end_pass (outfp, histogram, k_mers, mode);
+	}
+    }
+  else
     {
-      // check if line is a properties line (strating with '>')
-      if(temp_buf[0] == '>')
+      /* Count from the packed cache of the file when it is up to
+	 date, else map the file and index its sequences */
+      seqstore_t store;
+      fasta_file_t infp;
+      fasta_seq_t* all_sq = NULL;
+      size_t n_seq;
+      int cached = (seqstore_map(&store, in_file) == SEQSTORE_OK);
+      if (!cached)
 	{
-	  if(n_seq > 0)
+	  if (fasta_open(&infp, in_file) != FASTA_OK)
 	    {
-#             ifdef DEBUG  
-	      printf("Sequence %d of size %ld is %s \n", n_seq, sq_len, sq_buffer);
-#             endif
-	      all_sq[n_seq - 1] = (char*) malloc ((sq_len + 1)*sizeof(char));
-	      if(all_sq[n_seq - 1] == NULL)
+	      fprintf(stderr, "Error opening in file\n");
+	      exit(1);
+	    }
+	  if (fasta_index_parallel(&infp, nthreads, &all_sq, &n_seq)
+	      != FASTA_OK)
+	    {
+	      fprintf(stderr, "Malloc error while assigning memory to seq array\n");
+	      exit(1);
+	    }
+#ifdef DEBUG
+	  printf("%ld sequences in %ld bytes\n", n_seq, infp.size);
+#endif
+	}
+      packed = packed || cache || cached;
+
+      if (packed)
+	{
+	  if (!cached)
+	    {
+	      // the text is not needed once packed
+	      if (seqstore_build(&store, all_sq, n_seq, nthreads)
+		  != SEQSTORE_OK)
 		{
-		  fprintf(stderr, "Malloc error while assigning memory to char array\n");
+		  fprintf(stderr, "Malloc error while packing sequences\n");
 		  exit(1);
 		}
-	      strcpy(all_sq[n_seq - 1], sq_buffer);
-	      if ( n_seq % MAX_SQ == 0)
-		{
-		  all_sq_sz += MAX_SQ;
-		  all_sq = realloc(all_sq,(all_sq_sz*sizeof(char*)));
-		  if(all_sq == NULL)
-		    {
-		      fprintf(stderr, "Realloc error while re-assigning memory to vector\n");
-		      exit(1);
-		    }
-		}		   		
+	      free(all_sq);
+	      fasta_close(&infp);
+	      if (cache && seqstore_save(&store, in_file) != SEQSTORE_OK)
+		fprintf(stderr, "Warning - could not write %s%s\n", in_file,
+			SEQSTORE_EXT);
+	    }
+#ifdef DEBUG
+	  printf("%ld bases packed in %ld words, %ld invalid runs\n",
+		 store.n_bases, seqstore_words(&store), store.n_runs);
+#endif
+	  if (engine == ENGINE_SORT)
+	    sort_start (store.n_bases, k_mers, nthreads);
+	  // every pass reads the packed sequences again
+	  for (p = 0; p < passes; p++)
+	    {
+	      start_pass (histogram, p);
+	      gettimeofday(&t1, NULL);
+	      if (nthreads > 1 && engine != ENGINE_SORT)
+		process_parallel (NULL, &store, store.n_seq, k_mers, mode,
+				  histogram, nthreads, split);
+	      else
+		process_all_store (&store, k_mers, mode, histogram);
+	      elapsedTime += lap(&t1);
+	      end_pass (outfp, histogram, k_mers, mode);
 	    }
-	  strcpy(sq_buffer,"");
-	  sq_len = 0;
-	  n_seq++;
-	  continue; 
+	  seqstore_free(&store);
 	}
-      // to not include newline char
-      ln_len = strlen(temp_buf) - 1;
-      sq_len += ln_len; 
-      strncat(sq_buffer, temp_buf, ln_len);
-      
-      //sq_len = strlen(sq_buffer);
-
-    } // End While
-
-      // save last sequence
-# ifdef DEBUG  
-  printf("Sequence %d of size %ld is %s \n", n_seq, sq_len, sq_buffer);
-# endif
-  all_sq[n_seq - 1] = (char*) malloc ((sq_len + 1)*sizeof(char));
-  strcpy(all_sq[n_seq - 1], sq_buffer);
-  if ( n_seq % MAX_SQ == 0)
-    {
-      all_sq_sz += MAX_SQ;
-      all_sq = (char **) realloc (all_sq, (all_sq_sz*sizeof(char*)));
-    }		  
-  fclose(infp);
-
-  // process all sequences
-  gettimeofday(&t1, NULL);
-  process_all_sq (all_sq, n_seq, k_mers, histogram);
-  gettimeofday(&t2, NULL);
-  elapsedTime = (t2.tv_sec - t1.tv_sec) * 1000.0;      // sec to ms
-  elapsedTime += (t2.tv_usec - t1.tv_usec) / 1000.0;   // us to ms}
-  printf("Processing time: %5.3f ms\n", elapsedTime);
+      else
+	{
+	  // process all sequences
+	  if (engine == ENGINE_SORT)
+	    {
+	      // a record holds fewer k-mers than bytes
+	      size_t i, n_kmers = 0;
+	      for (i = 0; i < n_seq; i++)
+		n_kmers += all_sq[i].len;
+	      sort_start (n_kmers, k_mers, nthreads);
+	    }
+	  for (p = 0; p < passes; p++)
+	    {
+	      start_pass (histogram, p);
+	      gettimeofday(&t1, NULL);
+	      if (nthreads > 1 && engine != ENGINE_SORT)
+		process_parallel (all_sq, NULL, n_seq, k_mers, mode,
+				  histogram, nthreads, split);
+	      else
+		process_all_sq (all_sq, n_seq, k_mers, mode, histogram);
+	      elapsedTime += lap(&t1);
+	      end_pass (outfp, histogram, k_mers, mode);
+	    }
 
-  //Free data structure
-   for(i = 0; i < n_seq; i++)
-     {
-      free(all_sq[i]);
+	  //Free data structure
+	  free(all_sq);
+	  fasta_close(&infp);
+	}
     }
-   free(all_sq);
+  printf("Processing time: %5.3f ms\n", elapsedTime);
 
-  
-  // create an output file
-  FILE *outfp = fopen(out_file, "w");
-  if (outfp == NULL)
-    {
-      fprintf(stderr, "Error opening in file\n");
-      exit(1);
-    }
-  unsigned int fq;
-  char buff[100];
-  long long index;
-  for (index = 0LL; index < max_ent; index++)
+  if (engine == ENGINE_SORT && n_bins == 0)
     {
-      if((fq = histogram[index])!=0)
+      // the last batch is sorted here
+      gettimeofday(&t1, NULL);
+      if (kmsort_iterate(&sorter, print_sorted, outfp) != KMSORT_OK)
 	{
-	  get_char(buff, k_mers, index);
-	  fprintf(outfp,"%s %10u\n", buff, fq);
-	}	  
+	  fprintf(stderr, "Malloc error while sorting k-mers\n");
+	  exit(1);
+	}
+      kmsort_free(&sorter);
+      gettimeofday(&t2, NULL);
+#ifdef DEBUG
+      printf("Merge and output time: %5.3f ms\n",
+	     (t2.tv_sec - t1.tv_sec) * 1000.0
+	     + (t2.tv_usec - t1.tv_usec) / 1000.0);
+#endif
     }
+  print_report (outfp, k_mers);
   fclose(outfp);
   
-  free(histogram);
+  if (histogram != NULL)
+    ccount_free(histogram);
+  if (spectrum != NULL)
+    kmstat_spectrum_free(spectrum);
+  if (top != NULL)
+    kmstat_top_free(top);
   return 0;
 }
 
-void process_all_sq (char** all, size_t sq_num, int k_mers,
-		     unsigned int* histogram)
+/*
+ * Set up the partition buffers of the radix engine over histogram, or
+ * return NULL when k-mers are counted directly.
+ */
+static radix_count_t* engine_start (radix_count_t* rc, ccount_t* histogram)
 {
-  int i, j, sq_len;
-  long long in;
-  for(i = 0; i < sq_num; i++)
+  if (engine != ENGINE_RADIX || binner != NULL)
+    return NULL;
+  if (radix_init(rc, histogram) != RADIX_OK)
+    {
+      fprintf(stderr, "Malloc error while assigning memory to radix buffers\n");
+      exit(1);
+    }
+  return rc;
+}
+
+/*
+ * Add what is left in the buffers of rc to the histogram.
+ */
+static void engine_end (radix_count_t* rc)
+{
+  if (rc == NULL)
+    return;
+  radix_flush(rc);
+  radix_free(rc);
+}
+
+/*
+ * Add one to the counter of each of the n indexes at "in". Inlined for
+ * each counter width.
+ */
+static inline __attribute__((always_inline))
+void count_direct (ccount_t* histogram, const uint64_t* in, long n,
+		   const int width)
+{
+  long j;
+  for(j = 0; j < n; j++)
+    {
+      ccount_inc_w(histogram, in[j], width); // = *(histogram+in) + 1;
+#   ifdef DEBUG
+      printf("index = 0x%.8lX \n", in[j]);
+#   endif
+    }
+}
+
+/*
+ * Keep the n indexes at "in" of the range of the pass, as offsets in
+ * it. Return how many are kept.
+ */
+static inline long pass_range (uint64_t* in, long n, uint64_t n_ent)
+{
+  long j, m;
+  uint64_t off;
+  for(j = m = 0; j < n; j++)
+    if((off = in[j] - pass_low) < n_ent)
+      in[m++] = off;
+  return m;
+}
+
+/*
+ * Count the n indexes at "in", through the buffers of rc if not NULL,
+ * or in the sorter with the sort engine.
+ */
+static inline void count_indexes (ccount_t* histogram, radix_count_t* rc,
+				  uint64_t* in, long n)
+{
+  if (binner != NULL)
+    {
+      if (kmbin_add(binner, in, n) != KMBIN_OK)
+	{
+	  fprintf(stderr, "Error writing bin files\n");
+	  exit(1);
+	}
+      return;
+    }
+  if (passes > 1)
+    n = pass_range(in, n, histogram->n_ent);
+  if (engine == ENGINE_SORT)
     {
-      sq_len = strlen(all[i]);
-      char sub_sq[k_mers + 1]; // including '\0' char
-      for(j = 0; j <= sq_len - k_mers; j++)
+      if (kmsort_add(&sorter, in, n) != KMSORT_OK)
 	{
-	  memcpy(sub_sq, &all[i][j], k_mers);
-	  sub_sq[k_mers] = '\0';
-	  get_index(sub_sq, k_mers, &in);
-	  
-	  histogram[in]++; // = *(histogram+in) + 1;
-	  
-#     ifdef DEBUG
-	  printf("sub sq %s , index = 0x%.8lX \n",sub_sq, in);
-#     endif
+	  fprintf(stderr, "Malloc error while sorting k-mers\n");
+	  exit(1);
 	}
+      return;
+    }
+  if (rc != NULL)
+    {
+      radix_add(rc, in, n);
+      return;
+    }
+  if (histogram->width == 1)
+    count_direct (histogram, in, n, 1);
+  else if (histogram->width == 2)
+    count_direct (histogram, in, n, 2);
+  else
+    count_direct (histogram, in, n, 4);
+}
+
+void process_all_sq (fasta_seq_t* all, size_t sq_num, int k_mers, int mode,
+		     ccount_t* histogram)
+{
+  size_t i;
+  kmer_roll_t roll;
+  radix_count_t radix, *rc;
+  rc = engine_start(&radix, histogram);
+  kmer_roll_init(&roll, k_mers, mode);
+  for(i = 0; i < sq_num; i++)
+    {
+      kmer_roll_reset(&roll);
+      process_sq (&all[i], &roll, histogram, rc);
     } 
+  engine_end(rc);
 }
 
+/*
+ * Same as process_all_sq, over the records of a packed store.
+ */
+void process_all_store (const seqstore_t* store, int k_mers, int mode,
+			ccount_t* histogram)
+{
+  size_t i;
+  long n;
+  uint64_t in[KMER_BATCH];
+  kmer_roll_t roll;
+  seqstore_cursor_t cur;
+  radix_count_t radix, *rc;
+  rc = engine_start(&radix, histogram);
+  kmer_roll_init(&roll, k_mers, mode);
+  for(i = 0; i < store->n_seq; i++)
+    {
+      kmer_roll_reset(&roll);
+      seqstore_cursor_init(&cur, store, i);
+      while((n = kmer_store_batch(&roll, &cur, in)) >= 0)
+	count_indexes (histogram, rc, in, n);
+    } 
+  engine_end(rc);
+}
 
-void get_index(char* sq, size_t sz, long long *index)
+/*
+ * Count the k-mers of the records of a job that fall in its index range.
+ */
+static void* count_worker (void* arg)
 {
+  count_job_t* job = (count_job_t*) arg;
+  size_t i;
+  long j, m, n;
+  uint64_t in[KMER_BATCH];
+  kmer_roll_t roll;
+  fasta_cursor_t cur;
+  seqstore_cursor_t scur;
+  radix_count_t radix, *rc;
+  rc = engine_start(&radix, job->histogram);
+  kmer_roll_init(&roll, job->k_mers, job->mode);
+  for(i = job->lo; i < job->hi; i++)
+    {
+      kmer_roll_reset(&roll);
+      if(job->store)
+	seqstore_cursor_init(&scur, job->store, i);
+      else
+	fasta_cursor_init(&cur, &job->all[i]);
+      while((n = job->store ? kmer_store_batch(&roll, &scur, in)
+	     : kmer_batch(&roll, &cur, in)) >= 0)
+	{
+	  for(j = m = 0; j < n; j++)
+	    if(in[j] >= job->low && in[j] < job->high)
+	      in[m++] = in[j];
+	  count_indexes (job->histogram, rc, in, m);
+	}
+    }
+  engine_end(rc);
+  return NULL;
+}
+
+/*
+ * Add the slice of every private vector of a job to the result.
+ */
+static void* merge_worker (void* arg)
+{
+  count_job_t* job = (count_job_t*) arg;
   long long i;
-  *index = 0LL;
-  for(i = 0; i < sz; i++)
+  uint64_t v;
+  int p;
+  for(p = 0; p < job->nparts; p++)
+    for(i = job->low; i < job->high; i++)
+      if((v = ccount_get(&job->parts[p], i)) != 0)
+	ccount_add(job->histogram, i, v);
+  return NULL;
+}
+
+static inline uint64_t record_size (const fasta_seq_t* all,
+				   const seqstore_t* store, size_t i)
+{
+  return store ? store->offsets[i + 1] - store->offsets[i] : all[i].len;
+}
+
+/*
+ * Run fn on every job, job 0 (and any job whose thread cannot be
+ * started) on the calling thread.
+ */
+static void run_jobs (count_job_t* jobs, int n, void* (*fn)(void*))
+{
+  int t;
+  for(t = 1; t < n; t++)
+    jobs[t].running = (pthread_create(&jobs[t].tid, NULL, fn, &jobs[t]) == 0);
+  jobs[0].running = 0;
+  for(t = 0; t < n; t++)
+    if(!jobs[t].running)
+      fn(&jobs[t]);
+  for(t = 1; t < n; t++)
+    if(jobs[t].running)
+      pthread_join(jobs[t].tid, NULL);
+}
+
+/*
+ * Same as process_all_sq (or process_all_store when store is not NULL)
+ * with nthreads threads, sharing the work as "split" says.
+ */
+void process_parallel (const fasta_seq_t* all, const seqstore_t* store,
+		       size_t sq_num, int k_mers, int mode,
+		       ccount_t* histogram, int nthreads, int split)
+{
+  // the vector holds the indexes of the pass
+  long long max_ent = histogram->n_ent;
+  count_job_t jobs[nthreads];
+  ccount_t parts[nthreads];
+  uint64_t total = 0, done = 0;
+  size_t i;
+  int t;
+
+  for(i = 0; i < sq_num; i++)
+    total += record_size(all, store, i);
+  for(t = 0, i = 0; t < nthreads; t++)
     {
-      // compare string from last position to first
-      //printf("char i %ld = %c\n",i, sq[sz-(i+1)] );
-      switch (sq[sz-(i+1)]) {
-      case 'A': 
-	//index += 0;   
-	break;
-      case 'C':
-	*index += 1LL << 2LL * i;   
-	break;
-      case 'G': 
-	*index += 2LL << 2LL * i;      
-	break;
-      case 'T': 
-	*index += 3LL << 2LL * i;
-	break;
-      default:
-	break;
-      }
+      jobs[t].all = all;
+      jobs[t].store = store;
+      jobs[t].k_mers = k_mers;
+      jobs[t].mode = mode;
+      jobs[t].histogram = histogram;
+      jobs[t].low = pass_low;
+      jobs[t].high = pass_low + max_ent;
+      jobs[t].lo = 0;
+      jobs[t].hi = sq_num;
+      if(split == SPLIT_RANGE)
+	{
+	  // every thread reads all the records for its own indexes
+	  jobs[t].low = pass_low + t * (max_ent / nthreads);
+	  if(t < nthreads - 1)
+	    jobs[t].high = jobs[t].low + max_ent / nthreads;
+	  continue;
+	}
+      // records of about the same size, each thread but the first
+      // counting in a private vector
+      jobs[t].lo = i;
+      while(i < sq_num && done < total * (t + 1) / nthreads)
+	done += record_size(all, store, i++);
+      jobs[t].hi = (t == nthreads - 1) ? sq_num : i;
+      if(t > 0)
+	{
+	  if(ccount_init(&parts[t], max_ent, histogram->width) != CCOUNT_OK)
+	    {
+	      fprintf(stderr, "Calloc error while assigning memory to vector\n");
+	      exit(1);
+	    }
+	  jobs[t].histogram = &parts[t];
+	}
+    }
+  run_jobs(jobs, nthreads, count_worker);
+  if(split == SPLIT_RANGE)
+    return;
+
+  // each thread sums a slice of the private vectors into histogram
+  for(t = 0; t < nthreads; t++)
+    {
+      jobs[t].histogram = histogram;
+      jobs[t].parts = parts + 1;
+      jobs[t].nparts = nthreads - 1;
+      jobs[t].low = t * (max_ent / nthreads);
+      jobs[t].high = (t < nthreads - 1) ? jobs[t].low + max_ent / nthreads
+	: max_ent;
+    }
+  run_jobs(jobs, nthreads, merge_worker);
+  for(t = 1; t < nthreads; t++)
+    {
+      if(parts[t].err != CCOUNT_OK)
+	histogram->err = CCOUNT_ERR;
+      ccount_free(&parts[t]);
+    }
+}
+
+void process_stream (fasta_stream_t* in, int k_mers, int mode,
+		     ccount_t* histogram)
+{
+  int new_record, err;
+  fasta_seq_t chunk;
+  kmer_roll_t roll;
+  radix_count_t radix, *rc;
+  rc = engine_start(&radix, histogram);
+  kmer_roll_init(&roll, k_mers, mode);
+  // the encoder carries the last k_mers - 1 bases from one chunk to
+  // the next, it only restarts on a new record
+  while ((err = fasta_stream_next(in, &chunk, &new_record)) == FASTA_OK)
+    {
+      if(new_record)
+	kmer_roll_reset(&roll);
+      process_sq (&chunk, &roll, histogram, rc);
+    }
+  if (err == FASTA_ERR)
+    {
+      fprintf(stderr, "Error reading in file\n");
+      exit(1);
+    }
+  engine_end(rc);
+}
+
+/*
+ * Count out of core: stream the k-mers of in_file to n_bins bins under
+ * tmp, then read each bin back and count it, with histogram as the
+ * vector of one bin or with the sort engine, appending its counts to
+ * outfp.
+ */
+void process_bins (const char* in_file, int k_mers, int mode,
+		   ccount_t* histogram, const char* tmp, int n_bins,
+		   size_t buf_bytes, int nthreads, FILE* outfp)
+{
+  kmbin_t bins;
+  fasta_stream_t instr;
+  uint64_t* keys;
+  size_t n;
+  int b;
+  radix_count_t radix, *rc;
+
+  if (kmbin_init(&bins, tmp, n_bins, 2 * k_mers, buf_bytes) != KMBIN_OK)
+    {
+      fprintf(stderr, "Error creating %d bin files in %s\n", n_bins, tmp);
+      exit(1);
+    }
+  if (fasta_stream_open(&instr, in_file, STREAM_BUF) != FASTA_OK)
+    {
+      fprintf(stderr, "Error opening in file\n");
+      exit(1);
+    }
+  binner = &bins;
+  process_stream (&instr, k_mers, mode, NULL);
+  binner = NULL;
+  fasta_stream_close(&instr);
+  if (kmbin_flush(&bins) != KMBIN_OK)
+    {
+      fprintf(stderr, "Error writing bin files\n");
+      exit(1);
+    }
+
+  for (b = 0; b < bins.bins; b++)
+    {
+      if (kmbin_load(&bins, b, &keys, &n) != KMBIN_OK)
+	{
+	  fprintf(stderr, "Error reading bin files\n");
+	  exit(1);
+	}
+      if (engine == ENGINE_SORT)
+	{
+	  sort_start (n, k_mers, nthreads);
+	  count_indexes (NULL, NULL, keys, n);
+	  free(keys);
+	  if (kmsort_iterate(&sorter, print_sorted, outfp) != KMSORT_OK)
+	    {
+	      fprintf(stderr, "Malloc error while sorting k-mers\n");
+	      exit(1);
+	    }
+	  kmsort_free(&sorter);
+	  continue;
+	}
+      start_pass (histogram, b);
+      rc = engine_start(&radix, histogram);
+      count_indexes (histogram, rc, keys, n);
+      engine_end(rc);
+      free(keys);
+      end_pass (outfp, histogram, k_mers, mode);
+    }
+  kmbin_free(&bins);
+}
+
+/*
+ * Count the k-mers of a sequence (or a piece of it) continuing the
+ * window of the rolling encoder.
+ */
+void process_sq (const fasta_seq_t* sq, kmer_roll_t* roll,
+		 ccount_t* histogram, radix_count_t* rc)
+{
+  long n;
+  uint64_t in[KMER_BATCH];
+  fasta_cursor_t cur;
+  fasta_cursor_init(&cur, sq);
+  while((n = kmer_batch(roll, &cur, in)) >= 0)
+    count_indexes (histogram, rc, in, n);
+}
+
+/*
+ * Count the k-mers of every k of a sequence (or a piece of it)
+ * continuing the window of the encoder of mc.
+ */
+void multi_sq (multi_count_t* mc, const fasta_seq_t* sq)
+{
+  int j;
+  long n[KMER_MAX_MULTI];
+  static uint64_t in[KMER_MAX_MULTI * KMER_BATCH];
+  fasta_cursor_t cur;
+  fasta_cursor_init(&cur, sq);
+  while(kmer_multi_batch(&mc->enc, &cur, in, n) >= 0)
+    for(j = 0; j < mc->enc.n; j++)
+      count_indexes (&mc->histogram[j], mc->rc[j], in + j * KMER_BATCH, n[j]);
+}
+
+/*
+ * Count the n_k values of k at ks in one scan of in_file (streamed,
+ * from its text or from its packed sequences), then write the
+ * histogram of each k to <out_file>.k<k>.
+ */
+void process_multi (const char* in_file, int stream, int packed, int cache,
+		    int nthreads, const int* ks, int n_k, int canonical,
+		    int width, const char* out_file)
+{
+  multi_count_t mc;
+  int j, modes[KMER_MAX_MULTI], err, new_record;
+  size_t i, n_seq;
+  long n[KMER_MAX_MULTI];
+  static uint64_t in[KMER_MAX_MULTI * KMER_BATCH];
+  char name[220];
+  struct timeval t1;
+  double elapsedTime;
+
+  for (j = 0; j < n_k; j++)
+    {
+      modes[j] = KMER_FORWARD;
+      if (canonical)
+	modes[j] = (ks[j] % 2) ? KMER_CANONICAL_HALF : KMER_CANONICAL;
+      if (ccount_init(&mc.histogram[j], kmer_space(ks[j], modes[j]),
+		      width / 8) != CCOUNT_OK)
+	{
+	  fprintf(stderr, "Calloc error while assigning memory to vector\n");
+	  exit(1);
+	}
+      mc.rc[j] = NULL;
+      if (engine == ENGINE_RADIX || (engine < 0 && mc.histogram[j].n_ent
+				     >= (uint64_t) RADIX_MIN_ENT))
+	{
+	  if (radix_init(&mc.radix[j], &mc.histogram[j]) != RADIX_OK)
+	    {
+	      fprintf(stderr, "Malloc error while assigning memory to radix buffers\n");
+	      exit(1);
+	    }
+	  mc.rc[j] = &mc.radix[j];
+	}
+    }
+  kmer_multi_init(&mc.enc, ks, modes, n_k);
+
+  if (stream)
+    {
+      fasta_stream_t instr;
+      fasta_seq_t chunk;
+      if (fasta_stream_open(&instr, in_file, STREAM_BUF) != FASTA_OK)
+	{
+	  fprintf(stderr, "Error opening in file\n");
+	  exit(1);
+	}
+      gettimeofday(&t1, NULL);
+      while ((err = fasta_stream_next(&instr, &chunk, &new_record))
+	     == FASTA_OK)
+	{
+	  if (new_record)
+	    kmer_multi_reset(&mc.enc);
+	  multi_sq (&mc, &chunk);
+	}
+      if (err == FASTA_ERR)
+	{
+	  fprintf(stderr, "Error reading in file\n");
+	  exit(1);
+	}
+      elapsedTime = lap(&t1);
+      fasta_stream_close(&instr);
     }
+  else
+    {
+      seqstore_t store;
+      fasta_file_t infp;
+      fasta_seq_t* all_sq = NULL;
+      seqstore_cursor_t cur;
+      int cached = (seqstore_map(&store, in_file) == SEQSTORE_OK);
+      if (!cached)
+	{
+	  if (fasta_open(&infp, in_file) != FASTA_OK)
+	    {
+	      fprintf(stderr, "Error opening in file\n");
+	      exit(1);
+	    }
+	  if (fasta_index_parallel(&infp, nthreads, &all_sq, &n_seq)
+	      != FASTA_OK)
+	    {
+	      fprintf(stderr, "Malloc error while assigning memory to seq array\n");
+	      exit(1);
+	    }
+	}
+      packed = packed || cache || cached;
+      if (packed && !cached)
+	{
+	  if (seqstore_build(&store, all_sq, n_seq, nthreads) != SEQSTORE_OK)
+	    {
+	      fprintf(stderr, "Malloc error while packing sequences\n");
+	      exit(1);
+	    }
+	  free(all_sq);
+	  fasta_close(&infp);
+	  if (cache && seqstore_save(&store, in_file) != SEQSTORE_OK)
+	    fprintf(stderr, "Warning - could not write %s%s\n", in_file,
+		    SEQSTORE_EXT);
+	}
+      gettimeofday(&t1, NULL);
+      if (packed)
+	{
+	  for (i = 0; i < store.n_seq; i++)
+	    {
+	      kmer_multi_reset(&mc.enc);
+	      seqstore_cursor_init(&cur, &store, i);
+	      while (kmer_multi_store_batch(&mc.enc, &cur, in, n) >= 0)
+		for (j = 0; j < n_k; j++)
+		  count_indexes (&mc.histogram[j], mc.rc[j],
+				 in + j * KMER_BATCH, n[j]);
+	    }
+	  elapsedTime = lap(&t1);
+	  seqstore_free(&store);
+	}
+      else
+	{
+	  for (i = 0; i < n_seq; i++)
+	    {
+	      kmer_multi_reset(&mc.enc);
+	      multi_sq (&mc, &all_sq[i]);
+	    }
+	  elapsedTime = lap(&t1);
+	  free(all_sq);
+	  fasta_close(&infp);
+	}
+    }
+  for (j = 0; j < n_k; j++)
+    engine_end(mc.rc[j]);
+  printf("Processing time: %5.3f ms\n", elapsedTime);
+
+  for (j = 0; j < n_k; j++)
+    {
+      snprintf(name, sizeof(name), "%s.k%d", out_file, ks[j]);
+      FILE *outfp = fopen(name, "w");
+      if (outfp == NULL)
+	{
+	  fprintf(stderr, "Error opening in file\n");
+	  exit(1);
+	}
+      end_pass (outfp, &mc.histogram[j], ks[j], modes[j]);
+      print_report (outfp, ks[j]);
+      fclose(outfp);
+      ccount_free(&mc.histogram[j]);
+    }
+}
+
+/*
+ * Read a list of values of k "11,13,15" into ks, in increasing order.
+ * Return how many, or 0 when one is out of [1, KMER_MAX_K - 1], a
+ * value repeats or there are more than KMER_MAX_MULTI.
+ */
+int parse_k_list (const char* arg, int* ks)
+{
+  int n = 0, i, k;
+  char* end;
+  do
+    {
+      k = strtol(arg, &end, 10);
+      if (end == arg || k < 1 || k >= KMER_MAX_K || n == KMER_MAX_MULTI)
+	return 0;
+      for (i = n; i > 0 && ks[i - 1] > k; i--)
+	ks[i] = ks[i - 1];
+      if (i > 0 && ks[i - 1] == k)
+	return 0;
+      ks[i] = k;
+      n++;
+      arg = end + 1;
+    }
+  while (*end == ',');
+  return (*end == '\0') ? n : 0;
+}
+
+/*
+ * Set up the sorter of the sort engine for batches of n_kmers k-mers.
+ */
+void sort_start (size_t n_kmers, int k_mers, int nthreads)
+{
+  if (kmsort_init(&sorter, 2 * k_mers, n_kmers, nthreads) != KMSORT_OK)
+    {
+      fprintf(stderr, "Malloc error while assigning memory to sort buffer\n");
+      exit(1);
+    }
+}
+
+/*
+ * Write the count fq of the k-mer of index to outfp, or add it to the
+ * spectrum or the top k-mers when they are asked instead.
+ */
+static inline void report_count (FILE* outfp, int k_mers, uint64_t index,
+				 uint64_t fq)
+{
+  char buff[100];
+  if (spectrum != NULL)
+    kmstat_spectrum_add(spectrum, fq);
+  else if (top != NULL)
+    kmstat_top_add(top, index, fq);
+  else
+    {
+      get_char(buff, k_mers, index);
+      fprintf(outfp,"%s %10" PRIu64 "\n", buff, fq);
+    }
+}
+
+int print_sorted (void* item, uint64_t index, unsigned int count)
+{
+  report_count ((FILE*) item, sorter.bits / 2, index, count);
+  return KMSORT_OK;
+}
+
+/*
+ * Write the nonzero counts of histogram, the indexes from pass_low on.
+ */
+void print_counts (FILE* outfp, ccount_t* histogram, int k_mers, int mode)
+{
+  uint64_t fq;
+  long long index, end = pass_low + histogram->n_ent;
+  if (mode == KMER_FORWARD)
+    {
+      for (index = pass_low; index < end; index++)
+	if((fq = ccount_get(histogram, index - pass_low))!=0)
+	  report_count (outfp, k_mers, index, fq);
+      return;
+    }
+  // walk every k-mer in order and print the canonical ones
+  if (mode == KMER_CANONICAL_HALF)
+    end = kmer_space(k_mers, KMER_FORWARD);
+  for (index = pass_low; index < end; index++)
+    {
+      uint64_t rc = kmer_revcomp(index, k_mers);
+      if (rc < index)
+	continue;
+      if (mode == KMER_CANONICAL_HALF)
+	fq = ccount_get(histogram, kmer_half_index(index, rc, k_mers));
+      else
+	fq = ccount_get(histogram, index - pass_low);
+      if(fq != 0)
+	report_count (outfp, k_mers, index, fq);
+    }
+}
+
+/*
+ * Write the spectrum or the top k-mers gathered over all the passes,
+ * and empty them for the next histogram.
+ */
+void print_report (FILE* outfp, int k_mers)
+{
+  char buff[100];
+  size_t i;
+  if (spectrum != NULL)
+    {
+      if (kmstat_spectrum_write(spectrum, outfp) != KMSTAT_OK)
+	{
+	  fprintf(stderr, "Malloc error while assigning memory to spectrum\n");
+	  exit(1);
+	}
+      kmstat_spectrum_clear(spectrum);
+    }
+  if (top != NULL)
+    {
+      kmstat_top_sort(top);
+      for (i = 0; i < top->n; i++)
+	{
+	  get_char(buff, k_mers, top->heap[i].index);
+	  fprintf(outfp,"%s %10" PRIu64 "\n", buff, top->heap[i].count);
+	}
+      top->n = 0;
+    }
+}
+
+/*
+ * Set up the vector for pass p, the indexes from p * histogram->n_ent.
+ */
+void start_pass (ccount_t* histogram, long long p)
+{
+  if (histogram == NULL)
+    return;
+  pass_low = p * histogram->n_ent;
+  if (p > 0)
+    ccount_clear(histogram);
+}
+
+/*
+ * Append the counts of the pass to the output.
+ */
+void end_pass (FILE* outfp, ccount_t* histogram, int k_mers, int mode)
+{
+  if (histogram == NULL)
+    return;
+  if (histogram->err != CCOUNT_OK)
+    {
+      fprintf(stderr, "Malloc error while spilling counters\n");
+      exit(1);
+    }
+  print_counts (outfp, histogram, k_mers, mode);
+}
+
+/*
+ * Milliseconds since t1.
+ */
+double lap (const struct timeval* t1)
+{
+  struct timeval t2;
+  gettimeofday(&t2, NULL);
+  return (t2.tv_sec - t1->tv_sec) * 1000.0      // sec to ms
+    + (t2.tv_usec - t1->tv_usec) / 1000.0;      // us to ms
 }
 
 void get_char(char* sq, size_t sz, long long index)
@@ -0,0 +1,413 @@
+/**
+ *   \file histo.c
+ *   \brief Counts k-mers with the backend that fits a memory budget.
+ *
+ *  Detailed description
+ *  This program samples the input "fna" or "fasta" file, estimates how
+ *  many k-mers and distinct k-mers it holds, and picks the counting
+ *  backend that fits --max-mem: the dense vector of histo-vector (with
+ *  the widest counters that fit), its sort engine, or the hash table of
+ *  histo-hash.  It logs the choice and the expected footprint, then
+ *  runs that driver (found next to this program, or in the PATH).
+ *
+ *  Compile: gcc -Wall -o histo histo.c fasta.c kmer.c nucpack.c -lm -pthread
+ *  Usage: ./histo --max-mem 8192 Test_Bancomini.fna 15 out.dat
+ *
+ *  Options:
+ *    -M, --max-mem  memory budget in MB (default: physical memory)
+ *    -t, --threads  passed to the driver
+ *    -c, --canonical  passed to the driver
+ *    -n, --dry-run  only log the choice
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "fasta.h"
+#include "kmer.h"
+#include "wkmap.h"
+
+#define SAMPLE_RANGES 16           /* parts of the file sampled */
+#define SAMPLE_BYTES (256 << 10)   /* bytes read from each part */
+#define INITIAL_SET (1 << 16)
+#define DENSE_SPARSITY 16   /* largest vector entries per k-mer read */
+#define RADIX_BYTES (20LL << 20)   /* partition buffers of the radix engine */
+#define RECORD_BYTES 16            /* a record view, fasta_seq_t */
+#define SLOT_LOAD 3                /* a wkmap is at least 1/3 full ... */
+#define STRING_BYTES 310           /* ... a string key costs this much */
+
+/*
+ * What the sample tells about the input.
+ */
+typedef struct estimate_s
+{
+  double kmers;      /* k-mers of the input */
+  double distinct;   /* distinct k-mers */
+  double records;
+} estimate_t;
+
+/*
+ * Set of sampled k-mers (or of fingerprints of long ones) and how many
+ * times each was seen.
+ */
+typedef struct kset_s
+{
+  uint64_t* slots;   /* (key + 1, count) pairs, 0 if free */
+  size_t size;
+  size_t length;
+} kset_t;
+
+void estimate (const fasta_file_t* f, int k_mers, int canonical,
+	       estimate_t* e);
+void kset_add (kset_t* s, uint64_t key);
+char* driver_path (const char* argv0, const char* name);
+
+static struct option long_opts[] = {
+  {"max-mem", required_argument, NULL, 'M'},
+  {"threads", required_argument, NULL, 't'},
+  {"canonical", no_argument, NULL, 'c'},
+  {"dry-run", no_argument, NULL, 'n'},
+  {NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+  int opt, nthreads = 1, canonical = 0, dry_run = 0;
+  double budget = (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  while ((opt = getopt_long(argc, argv, "M:t:cn", long_opts, NULL)) != -1)
+    {
+      switch (opt) {
+      case 'M':
+	budget = strtod(optarg, NULL) * (1 << 20);
+	break;
+      case 't':
+	nthreads = strtol(optarg, NULL, 10);
+	break;
+      case 'c':
+	canonical = 1;
+	break;
+      case 'n':
+	dry_run = 1;
+	break;
+      default:
+	argc = 0; // print usage
+	break;
+      }
+    }
+  if (argc - optind != 3)
+    {
+      fprintf(stderr, "ERROR - usage: histo [--max-mem MB] [--threads N] [--canonical] [--dry-run] <file> k_mers <outfile>\n");
+      exit(1);
+    }
+  char* in_file = argv[optind];
+  char* k_arg = argv[optind + 1];
+  char* out_file = argv[optind + 2];
+  int k_mers = strtol(k_arg, NULL, 10);
+  if (k_mers < 1)
+    {
+      fprintf(stderr, "ERROR - k_mers must be positive\n");
+      exit(1);
+    }
+
+  fasta_file_t infp;
+  estimate_t e;
+  if (fasta_open(&infp, in_file) != FASTA_OK)
+    {
+      fprintf(stderr, "Error opening in file\n");
+      exit(1);
+    }
+  estimate(&infp, k_mers, canonical, &e);
+  fasta_close(&infp);
+
+  // footprint of every backend, the index of the records included
+  double index = e.records * RECORD_BYTES;
+  double space = (k_mers < KMER_MAX_K) ? (double) (1ULL << (2 * k_mers)) : 0;
+  if (canonical && k_mers % 2)
+    space /= 2;
+  if (space > 0 && e.distinct > space)
+    e.distinct = space;
+  double sort = 2 * sizeof(uint64_t) * e.kmers
+    + (sizeof(uint64_t) + sizeof(unsigned int)) * e.distinct + index;
+  double hash = (k_mers <= WKMER_MAX_K)
+    ? SLOT_LOAD * e.distinct * (wkmer_words(k_mers) + 1) * sizeof(uint64_t)
+    : e.distinct * STRING_BYTES;
+  hash += index;
+
+  // the choice, as the arguments of the driver
+  char* args[16];
+  char threads[16], width[16], mem[32];
+  const char* what;
+  double need;
+  int n = 0, w = 0;
+  snprintf(threads, sizeof(threads), "%d", nthreads);
+  args[n++] = "histo-vector";
+  args[n++] = "--threads";
+  args[n++] = threads;
+  if (canonical)
+    args[n++] = "--canonical";
+  if (k_mers < KMER_MAX_K && space <= DENSE_SPARSITY * e.kmers)
+    // the widest counters that fit
+    for (w = 4; w >= 1; w /= 2)
+      if (space * w + RADIX_BYTES + index <= budget)
+	break;
+  if (w >= 1 && k_mers < KMER_MAX_K && space <= DENSE_SPARSITY * e.kmers)
+    {
+      what = "dense vector";
+      need = space * w + RADIX_BYTES + index;
+      snprintf(width, sizeof(width), "%d", 8 * w);
+      args[n++] = "--width";
+      args[n++] = width;
+    }
+  else if (k_mers < KMER_MAX_K && sort <= budget)
+    {
+      what = "sort and count";
+      need = sort;
+      args[n++] = "--engine";
+      args[n++] = "sort";
+    }
+  else if (k_mers >= KMER_MAX_K || hash <= budget)
+    {
+      // the only one past 64-bit keys
+      what = "hash table (histo-hash)";
+      need = hash;
+      args[0] = "histo-hash";
+    }
+  else
+    {
+      // the counted batches stay in memory, the rest sorts a batch
+      double left = budget - (sizeof(uint64_t) + sizeof(unsigned int))
+	* e.distinct;
+      long long batch = (long long) (left / 2 / (1 << 20));
+      if (batch < 1)
+	batch = 1;
+      what = "sort and count, streamed in batches";
+      need = budget - left + batch * (double) (1 << 20);
+      snprintf(mem, sizeof(mem), "%lld", batch);
+      args[n++] = "--engine";
+      args[n++] = "sort";
+      args[n++] = "--stream";
+      args[n++] = "--mem";
+      args[n++] = mem;
+    }
+  printf("histo: k=%d, ~%.3g k-mers, ~%.3g distinct: %s", k_mers, e.kmers,
+	 e.distinct, what);
+  if (w >= 1 && what[0] == 'd')
+    printf(" (%d-bit counters)", 8 * w);
+  printf(", ~%.1f MB of %.1f MB\n", need / (1 << 20), budget / (1 << 20));
+  if (need > budget)
+    printf("histo: WARNING - no backend fits the budget\n");
+  fflush(stdout);
+  if (dry_run)
+    return 0;
+
+  args[n++] = in_file;
+  args[n++] = k_arg;
+  args[n++] = out_file;
+  args[n] = NULL;
+  char* path = driver_path(argv[0], args[0]);
+  if (strchr(path, '/') != NULL)
+    execv(path, args);
+  else
+    execvp(path, args);
+  fprintf(stderr, "Error running %s\n", path);
+  return 1;
+}
+
+/*
+ * Count the k-mers of a view of sequence lines in the set, continuing
+ * the window of roll (or of wide for k_mers >= KMER_MAX_K).
+ */
+static long sample_view (const fasta_seq_t* v, kmer_roll_t* roll,
+			 wkmer_roll_t* wide, int canonical, kset_t* set)
+{
+  long j, n, total = 0;
+  uint64_t in[KMER_BATCH], h;
+  fasta_cursor_t cur;
+  int b, i;
+  fasta_cursor_init(&cur, v);
+  if (wide == NULL)
+    {
+      while ((n = kmer_batch(roll, &cur, in)) >= 0)
+	for (j = 0, total += n; j < n; j++)
+	  kset_add(set, in[j]);
+      return total;
+    }
+  // long k-mers are kept as a 64-bit fingerprint of their key
+  while ((b = fasta_cursor_next(&cur)) >= 0)
+    if (wkmer_roll(wide, b, wide->words))
+      {
+	const uint64_t* key = wide->fwd;
+	if (canonical && wkmer_cmp(wide->rev, wide->fwd, wide->words) < 0)
+	  key = wide->rev;
+	for (i = 0, h = 0; i < wide->words; i++)
+	  h = (h ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+	kset_add(set, h >> 1);
+	total++;
+      }
+  return total;
+}
+
+/*
+ * Read SAMPLE_RANGES evenly spaced ranges of SAMPLE_BYTES of the file
+ * (all of it when smaller) and scale what they hold to the whole file.
+ * Distinct k-mers grow as the sampled ones plus, for the unread part,
+ * as many new ones as the sample had singletons.
+ */
+void estimate (const fasta_file_t* f, int k_mers, int canonical,
+	       estimate_t* e)
+{
+  kset_t set;
+  kmer_roll_t roll;
+  wkmer_roll_t wide;
+  wkmer_roll_t* w = NULL;
+  fasta_seq_t v;
+  const char *p, *q, *end, *nl;
+  double read = 0, kmers = 0, records = 0, once = 0;
+  size_t r, i, ranges = SAMPLE_RANGES, bytes = SAMPLE_BYTES;
+
+  set.size = INITIAL_SET;
+  set.length = 0;
+  set.slots = (uint64_t*) calloc(2 * set.size, sizeof(uint64_t));
+  if (set.slots == NULL)
+    {
+      fprintf(stderr, "Calloc error while assigning memory to sample\n");
+      exit(1);
+    }
+  if (k_mers < KMER_MAX_K)
+    kmer_roll_init(&roll, k_mers,
+		   canonical ? KMER_CANONICAL : KMER_FORWARD);
+  else if (k_mers <= WKMER_MAX_K)
+    {
+      wkmer_roll_init(&wide, k_mers);
+      w = &wide;
+    }
+  if (f->size <= ranges * bytes)
+    {
+      ranges = 1;
+      bytes = f->size;
+    }
+  for (r = 0; r < ranges && k_mers <= WKMER_MAX_K; r++)
+    {
+      // from the first line after the start of the range
+      p = f->data + f->size / ranges * r;
+      end = (p + bytes < f->data + f->size) ? p + bytes : f->data + f->size;
+      if (p > f->data && p[-1] != '\n')
+	{
+	  nl = (const char*) memchr(p, '\n', end - p);
+	  p = (nl == NULL) ? end : nl + 1;
+	}
+      read += end - p;
+      // only the encoder set up for this k has a window
+      if (w != NULL)
+	w->filled = 0;
+      else
+	kmer_roll_reset(&roll);
+      while (p < end)
+	{
+	  if (*p == '>')
+	    {
+	      // a header ends the window
+	      nl = (const char*) memchr(p, '\n', end - p);
+	      p = (nl == NULL) ? end : nl + 1;
+	      if (w != NULL)
+		w->filled = 0;
+	      else
+		kmer_roll_reset(&roll);
+	      records++;
+	      continue;
+	    }
+	  // the sequence lines up to the next header
+	  for (q = p; q < end && *q != '>'; )
+	    {
+	      nl = (const char*) memchr(q, '\n', end - q);
+	      q = (nl == NULL) ? end : nl + 1;
+	    }
+	  v.start = p;
+	  v.len = q - p;
+	  kmers += sample_view(&v, &roll, w, canonical, &set);
+	  p = q;
+	}
+    }
+  for (i = 0; i < set.size; i++)
+    once += (set.slots[2 * i + 1] == 1);
+
+  double scale = (read > 0) ? f->size / read : 1;
+  e->kmers = kmers * scale;
+  e->records = (records > 0 ? records : 1) * scale;
+  e->distinct = set.length + once * (scale - 1);
+  if (e->distinct > e->kmers)
+    e->distinct = e->kmers;
+  // long string keys are not sampled: assume they are all distinct
+  if (k_mers > WKMER_MAX_K)
+    e->distinct = e->kmers = f->size;
+  free(set.slots);
+}
+
+/*
+ * Pair of the set holding key, or the free pair where it goes.
+ */
+static uint64_t* kset_probe (uint64_t* slots, size_t size, uint64_t key)
+{
+  size_t i = (key * 0x9E3779B97F4A7C15ULL) >> 17 & (size - 1);
+  for (;; i = (i + 1) & (size - 1))
+    if (slots[2 * i] == 0 || slots[2 * i] == key + 1)
+      return slots + 2 * i;
+}
+
+void kset_add (kset_t* s, uint64_t key)
+{
+  size_t i;
+  uint64_t *slot, *slots;
+  // keep the load under 1/2
+  if (2 * (s->length + 1) > s->size)
+    {
+      slots = (uint64_t*) calloc(4 * s->size, sizeof(uint64_t));
+      if (slots == NULL)
+	{
+	  fprintf(stderr, "Calloc error while assigning memory to sample\n");
+	  exit(1);
+	}
+      for (i = 0; i < s->size; i++)
+	if (s->slots[2 * i] != 0)
+	  {
+	    slot = kset_probe(slots, 2 * s->size, s->slots[2 * i] - 1);
+	    slot[0] = s->slots[2 * i];
+	    slot[1] = s->slots[2 * i + 1];
+	  }
+      free(s->slots);
+      s->slots = slots;
+      s->size *= 2;
+    }
+  slot = kset_probe(s->slots, s->size, key);
+  if (slot[0] == 0)
+    {
+      slot[0] = key + 1;
+      s->length++;
+    }
+  slot[1]++;
+}
+
+/*
+ * Path of the driver "name": next to argv0 when it holds a directory,
+ * else the bare name, looked up in the PATH.
+ */
+char* driver_path (const char* argv0, const char* name)
+{
+  const char* slash = strrchr(argv0, '/');
+  char* path;
+  size_t dir;
+  if (slash == NULL)
+    return (char*) name;
+  dir = slash - argv0 + 1;
+  path = (char*) malloc(dir + strlen(name) + 1);
+  if (path == NULL)
+    return (char*) name;
+  memcpy(path, argv0, dir);
+  strcpy(path + dir, name);
+  return path;
+}
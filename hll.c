@@ -0,0 +1,44 @@
+/*
+ * HyperLogLog estimate of the number of distinct k-mers.
+ */
+#include "hll.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+int hll_init(hll_t* h, int p)
+{
+  h->p = (p < 4) ? 4 : (p > 18) ? 18 : p;
+  h->reg = (uint8_t*) calloc(1 << h->p, 1);
+  return h->reg ? HLL_OK : HLL_ERR;
+}
+
+void hll_free(hll_t* h)
+{
+  free(h->reg);
+  h->reg = NULL;
+}
+
+double hll_estimate(const hll_t* h)
+{
+  int i, m = 1 << h->p, zeros = 0;
+  double sum = 0, alpha, e;
+  for(i = 0; i < m; i++)
+    {
+      sum += ldexp(1.0, -h->reg[i]);
+      zeros += (h->reg[i] == 0);
+    }
+  alpha = (m == 16) ? 0.673 : (m == 32) ? 0.697 : (m == 64) ? 0.709
+    : 0.7213 / (1 + 1.079 / m);
+  e = alpha * m * (double) m / sum;
+  // few distinct hashes: linear counting of the empty registers is
+  // closer
+  if(e <= 2.5 * m && zeros > 0)
+    e = m * log((double) m / zeros);
+  return e;
+}
+
+double hll_error(const hll_t* h)
+{
+  return 1.04 / sqrt((double) (1 << h->p));
+}
@@ -0,0 +1,68 @@
+/**
+ *   \file hll.h
+ *   \brief HyperLogLog estimate of the number of distinct k-mers.
+ *
+ *  One byte per register, 2^p registers: a k-mer hash picks a register
+ *  with its top p bits and the register keeps the longest run of
+ *  leading zeros seen in the other bits.  The harmonic mean of the
+ *  registers estimates the distinct k-mers within about 1.04 / 2^(p/2)
+ *  (0.8% for p = 14, 16 KB), counting each k-mer in a few cycles and
+ *  no memory growth, which makes it cheap enough to run before the
+ *  real count to size the tables.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __HLL_H__
+#define __HLL_H__
+
+#include <stdint.h>
+
+#define HLL_ERR -1   /* Memory error */
+#define HLL_OK 0     /* OK */
+
+#define HLL_BITS 14   /* default precision */
+
+typedef struct hll_s
+{
+  uint8_t* reg;
+  int p;   /* 2^p registers, 4 <= p <= 18 */
+} hll_t;
+
+/*
+ * Set up 2^p empty registers. Return HLL_OK or HLL_ERR.
+ */
+extern int hll_init(hll_t* h, int p);
+
+extern void hll_free(hll_t* h);
+
+/*
+ * Estimated distinct hashes added.
+ */
+extern double hll_estimate(const hll_t* h);
+
+/*
+ * Relative standard error of the estimate.
+ */
+extern double hll_error(const hll_t* h);
+
+/*
+ * Add the k-mer of 64-bit hash x, mixed again so that weak hashes keep
+ * their leading bits random.
+ */
+static inline void hll_add(hll_t* h, uint64_t x)
+{
+  uint64_t rest;
+  uint8_t rank;
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  // leading zeros of the bits below the register number, plus one
+  rest = (x << h->p) | (1ULL << (h->p - 1));
+  rank = (uint8_t) __builtin_clzll(rest) + 1;
+  if(rank > h->reg[x >> (64 - h->p)])
+    h->reg[x >> (64 - h->p)] = rank;
+}
+
+#endif // __HLL_H__
@@ -0,0 +1,75 @@
+/*
+ * Huge page allocation of large zeroed tables.
+ */
+#define _GNU_SOURCE
+#include "hugemem.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+int hugemem_pages = HUGEMEM_HUGE;
+
+static size_t round_page(size_t size)
+{
+  return (size + HUGEMEM_PAGE - 1) & ~(HUGEMEM_PAGE - 1);
+}
+
+void* hugemem_alloc(size_t size)
+{
+  size_t len = round_page(size), skip;
+  char* p;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if(size < HUGEMEM_MIN)
+    return calloc(size, 1);
+#ifdef MAP_HUGETLB
+  if(hugemem_pages == HUGEMEM_HUGE)
+    {
+      // reserved up front: fails, rather than faulting later, when the
+      // pool is short
+#ifdef MAP_HUGE_SHIFT
+      p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	       flags | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+#else
+      p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+	       -1, 0);
+#endif
+      if(p != MAP_FAILED)
+	return p;
+    }
+#endif
+  // no huge page pool: map one page more and keep the part aligned to
+  // a huge page, which transparent huge pages can back
+  p = mmap(NULL, len + HUGEMEM_PAGE, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if(p == MAP_FAILED)
+    return NULL;
+  skip = (HUGEMEM_PAGE - ((uintptr_t) p & (HUGEMEM_PAGE - 1)))
+    & (HUGEMEM_PAGE - 1);
+  if(skip > 0)
+    munmap(p, skip);
+  munmap(p + skip + len, HUGEMEM_PAGE - skip);
+  p += skip;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+  madvise(p, len, (hugemem_pages == HUGEMEM_HUGE) ? MADV_HUGEPAGE
+	  : MADV_NOHUGEPAGE);
+#endif
+  return p;
+}
+
+void hugemem_free(void* p, size_t size)
+{
+  if(p == NULL)
+    return;
+  if(size < HUGEMEM_MIN)
+    free(p);
+  else
+    munmap(p, round_page(size));
+}
+
+void hugemem_zero(void* p, size_t size)
+{
+  if(size < HUGEMEM_MIN
+     || madvise(p, round_page(size), MADV_DONTNEED) != 0)
+    memset(p, 0, size);
+}
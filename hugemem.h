@@ -0,0 +1,48 @@
+/**
+ *   \file hugemem.h
+ *   \brief Zeroed allocation of large histograms on huge pages.
+ *
+ *  A dense histogram of several GB is incremented at random: with 4 KB
+ *  pages nearly every increment misses the TLB.  Tables of at least
+ *  HUGEMEM_MIN bytes are mapped anonymously instead of calloc'ed, from
+ *  the huge page pool (MAP_HUGETLB) when it has room, else aligned to
+ *  2 MB and advised for transparent huge pages.  Anonymous memory is
+ *  zero until written, so nothing is cleared up front, and the pages
+ *  never touched are never backed.  Smaller tables use calloc.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __HUGEMEM_H__
+#define __HUGEMEM_H__
+
+#include <stddef.h>
+
+#define HUGEMEM_PAGE (2UL << 20)   /* huge page size */
+#define HUGEMEM_MIN HUGEMEM_PAGE   /* smallest table mapped */
+
+/* hugemem_pages */
+#define HUGEMEM_HUGE 1     /* huge pages when possible (default) */
+#define HUGEMEM_NORMAL 0   /* mapped, but 4 KB pages only */
+
+/*
+ * Page size asked for the tables mapped from now on.
+ */
+extern int hugemem_pages;
+
+/*
+ * size bytes of zeroed memory, or NULL.
+ */
+extern void* hugemem_alloc(size_t size);
+
+/*
+ * Release p, of size bytes as allocated.
+ */
+extern void hugemem_free(void* p, size_t size);
+
+/*
+ * Zero the size bytes at p again. Mapped pages are given back to the
+ * kernel and read as zero afterwards.
+ */
+extern void hugemem_zero(void* p, size_t size);
+
+#endif // __HUGEMEM_H__
@@ -0,0 +1,99 @@
+/*
+ * Open addressing counter of 64-bit k-mer keys.
+ */
+#include "kmap.h"
+
+#include <stdlib.h>
+
+#define INITIAL_BITS 16
+
+int kmap_init(kmap_t* m)
+{
+  return kmap_init_size(m, 0);
+}
+
+int kmap_init_size(kmap_t* m, size_t n)
+{
+  // the load stays under 3/4
+  m->bits = INITIAL_BITS;
+  while(4 * n > 3 * ((size_t) 1 << m->bits))
+    m->bits++;
+  m->size = (size_t) 1 << m->bits;
+  m->length = 0;
+  m->spill.slots = NULL;
+  m->err = MAP_OK;
+  m->slots = (kmap_slot_t*) calloc(m->size, sizeof(kmap_slot_t));
+  return m->slots ? MAP_OK : MAP_OMEM;
+}
+
+int kmap_grow(kmap_t* m)
+{
+  size_t i, old_size = m->size;
+  kmap_slot_t* old = m->slots;
+  m->slots = (kmap_slot_t*) calloc(2 * old_size, sizeof(kmap_slot_t));
+  if(!m->slots)
+    {
+      m->slots = old;
+      return MAP_OMEM;
+    }
+  m->bits++;
+  m->size = 2 * old_size;
+  for(i = 0; i < old_size; i++)
+    if(old[i].count != 0)
+      *kmap_probe(m, old[i].key) = old[i];
+  free(old);
+  return MAP_OK;
+}
+
+void kmap_spill(kmap_t* m, uint64_t key, uint64_t v)
+{
+  uint64_t wkey[2] = { key, 0 };
+  if(m->spill.slots == NULL && wkmap_init(&m->spill, 2) != MAP_OK)
+    {
+      m->err = MAP_OMEM;
+      return;
+    }
+  if(wkmap_add_n(&m->spill, wkey, v) != MAP_OK)
+    m->err = MAP_OMEM;
+}
+
+/*
+ * Count held in the slot s, with its spilled part.
+ */
+static uint64_t slot_count(kmap_t* m, const kmap_slot_t* s)
+{
+  uint64_t wkey[2] = { s->key, 0 }, *extra;
+  if(s->count < UINT32_MAX || m->spill.slots == NULL)
+    return s->count;
+  extra = wkmap_count(&m->spill, wkey);
+  return (uint64_t) s->count + (extra ? *extra : 0);
+}
+
+uint64_t kmap_get(kmap_t* m, uint64_t key)
+{
+  return slot_count(m, kmap_probe(m, key));
+}
+
+int kmap_iterate(kmap_t* m, kmap_fn f, any_t item)
+{
+  size_t i;
+  int status;
+  for(i = 0; i < m->size; i++)
+    {
+      if(m->slots[i].count == 0)
+	continue;
+      status = f(item, m->slots[i].key, slot_count(m, &m->slots[i]));
+      if(status != MAP_OK)
+	return status;
+    }
+  return MAP_OK;
+}
+
+void kmap_free(kmap_t* m)
+{
+  free(m->slots);
+  m->slots = NULL;
+  m->size = m->length = 0;
+  if(m->spill.slots != NULL)
+    wkmap_free(&m->spill);
+}
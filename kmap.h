@@ -0,0 +1,137 @@
+/**
+ *   \file kmap.h
+ *   \brief Hash counter of k-mers of up to 32 bases in 64-bit keys.
+ *
+ *  The key of a k-mer is its index (kmer.h), stored inline with a
+ *  32-bit count in a 12-byte slot of an open addressing table (linear
+ *  probing from a multiplicative hash, power of 2 size): no string, no
+ *  pointer, no allocation per k-mer, and a probe reads one cache line.
+ *  A count that does not fit in 32 bits stops at UINT32_MAX and the
+ *  rest goes to a spill wkmap, created when first needed.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __KMAP_H__
+#define __KMAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hashmap.h"
+#include "wkmap.h"
+
+typedef struct __attribute__((packed)) kmap_slot_s
+{
+  uint64_t key;
+  uint32_t count;   /* 0 for a free slot */
+} kmap_slot_t;
+
+typedef struct kmap_s
+{
+  kmap_slot_t* slots;
+  size_t size;       /* slots, 2^bits */
+  size_t length;     /* keys held */
+  int bits;
+  wkmap_t spill;     /* counts over UINT32_MAX, keyed (key, 0) */
+  int err;           /* MAP_OMEM once the spill map could not grow */
+} kmap_t;
+
+/*
+ * Called with (item, key, count) for every key of the map. Returns a
+ * map status code, anything but MAP_OK stops the traversal.
+ */
+typedef int (*kmap_fn)(any_t item, uint64_t key, uint64_t count);
+
+/*
+ * Set up an empty counter. Return MAP_OK or MAP_OMEM.
+ */
+extern int kmap_init(kmap_t* m);
+
+/*
+ * Same as kmap_init, with room for n keys before the table grows.
+ */
+extern int kmap_init_size(kmap_t* m, size_t n);
+
+/*
+ * Double the table. Return MAP_OK or MAP_OMEM.
+ */
+extern int kmap_grow(kmap_t* m);
+
+/*
+ * Add v to the part of the count of key over UINT32_MAX.
+ */
+extern void kmap_spill(kmap_t* m, uint64_t key, uint64_t v);
+
+/*
+ * Count of key, 0 when missing.
+ */
+extern uint64_t kmap_get(kmap_t* m, uint64_t key);
+
+extern int kmap_iterate(kmap_t* m, kmap_fn f, any_t item);
+
+extern void kmap_free(kmap_t* m);
+
+/*
+ * Slot holding key, or the free slot where it goes.
+ */
+static inline kmap_slot_t* kmap_probe(const kmap_t* m, uint64_t key)
+{
+  size_t i = (key * 0x9E3779B97F4A7C15ULL) >> (64 - m->bits);
+  for(;; i = (i + 1) & (m->size - 1))
+    if(m->slots[i].count == 0 || m->slots[i].key == key)
+      return &m->slots[i];
+}
+
+static inline void kmap_bump(kmap_t* m, kmap_slot_t* s, uint64_t v)
+{
+  if(v <= UINT32_MAX - s->count)
+    {
+      s->count += v;
+      return;
+    }
+  kmap_spill(m, s->key, v - (UINT32_MAX - s->count));
+  s->count = UINT32_MAX;
+}
+
+/*
+ * Add v (not 0) to the count of key, inserting it if missing.
+ * Return MAP_OK or MAP_OMEM.
+ */
+static inline int kmap_add_n(kmap_t* m, uint64_t key, uint64_t v)
+{
+  kmap_slot_t* s = kmap_probe(m, key);
+  if(s->count == 0)
+    {
+      // keep the load under 3/4, probe sequences stay short
+      if(4 * (m->length + 1) > 3 * m->size)
+	{
+	  if(kmap_grow(m) != MAP_OK)
+	    return MAP_OMEM;
+	  s = kmap_probe(m, key);
+	}
+      s->key = key;
+      m->length++;
+    }
+  kmap_bump(m, s, v);
+  return m->err;
+}
+
+static inline int kmap_add(kmap_t* m, uint64_t key)
+{
+  return kmap_add_n(m, key, 1);
+}
+
+/*
+ * Add one to the count of key if it is held. Return 1, or 0 when key
+ * is missing.
+ */
+static inline int kmap_inc(kmap_t* m, uint64_t key)
+{
+  kmap_slot_t* s = kmap_probe(m, key);
+  if(s->count == 0)
+    return 0;
+  kmap_bump(m, s, 1);
+  return 1;
+}
+
+#endif // __KMAP_H__
@@ -0,0 +1,184 @@
+/*
+ * On-disk bins of k-mer indexes.
+ */
+#include "kmbin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define BIN_PATH (KMBIN_PATH + 16)   /* the directory and a bin number */
+
+static void bin_path(const kmbin_t* b, int i, char* path)
+{
+  snprintf(path, BIN_PATH, "%s/%d", b->dir, i);
+}
+
+/*
+ * Write or read all of len bytes at p, through short transfers.
+ */
+static int write_all(int fd, const unsigned char* p, size_t len)
+{
+  ssize_t done;
+  while(len > 0)
+    {
+      done = write(fd, p, len);
+      if(done < 0 && errno == EINTR)
+	continue;
+      if(done <= 0)
+	return KMBIN_ERR;
+      p += done;
+      len -= done;
+    }
+  return KMBIN_OK;
+}
+
+static int read_all(int fd, unsigned char* p, size_t len)
+{
+  ssize_t done;
+  while(len > 0)
+    {
+      done = read(fd, p, len);
+      if(done < 0 && errno == EINTR)
+	continue;
+      if(done <= 0)
+	return KMBIN_ERR;
+      p += done;
+      len -= done;
+    }
+  return KMBIN_OK;
+}
+
+int kmbin_init(kmbin_t* b, const char* tmp, int bins, int bits,
+	       size_t buf_bytes)
+{
+  char path[BIN_PATH];
+  int i, pbits = 0;
+  while((1 << pbits) < bins)
+    pbits++;
+  if(pbits > bits)
+    pbits = bits;
+  b->bins = 1 << pbits;
+  b->shift = bits - pbits;
+  b->word = (b->shift <= 32) ? 4 : 8;
+  b->cap = buf_bytes / b->word;
+  if(b->cap == 0)
+    b->cap = 1;
+  b->fd = NULL;
+  b->fill = NULL;
+  b->n = NULL;
+  b->buf = NULL;
+  b->dir[0] = '\0';
+  if(snprintf(b->dir, KMBIN_PATH, "%s/kmbin-XXXXXX", tmp) >= KMBIN_PATH
+     || mkdtemp(b->dir) == NULL)
+    {
+      b->dir[0] = '\0';
+      return KMBIN_ERR;
+    }
+  b->fd = (int*) malloc(b->bins * sizeof(int));
+  b->fill = (size_t*) calloc(b->bins, sizeof(size_t));
+  b->n = (uint64_t*) calloc(b->bins, sizeof(uint64_t));
+  b->buf = (unsigned char*) malloc((size_t) b->bins * b->cap * b->word);
+  if(b->fd == NULL || b->fill == NULL || b->n == NULL || b->buf == NULL)
+    {
+      free(b->fd);
+      b->fd = NULL;
+      kmbin_free(b);
+      return KMBIN_ERR;
+    }
+  for(i = 0; i < b->bins; i++)
+    b->fd[i] = -1;
+  for(i = 0; i < b->bins; i++)
+    {
+      bin_path(b, i, path);
+      if((b->fd[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+	{
+	  kmbin_free(b);
+	  return KMBIN_ERR;
+	}
+    }
+  return KMBIN_OK;
+}
+
+int kmbin_write(kmbin_t* b, int i)
+{
+  if(b->fill[i] == 0)
+    return KMBIN_OK;
+  if(write_all(b->fd[i], b->buf + (size_t) i * b->cap * b->word,
+	       b->fill[i] * b->word) != KMBIN_OK)
+    return KMBIN_ERR;
+  b->n[i] += b->fill[i];
+  b->fill[i] = 0;
+  return KMBIN_OK;
+}
+
+int kmbin_flush(kmbin_t* b)
+{
+  int i;
+  for(i = 0; i < b->bins; i++)
+    if(kmbin_write(b, i) != KMBIN_OK)
+      return KMBIN_ERR;
+  return KMBIN_OK;
+}
+
+int kmbin_load(kmbin_t* b, int i, uint64_t** keys, size_t* n)
+{
+  char path[BIN_PATH];
+  uint64_t base = (uint64_t) i << b->shift;
+  uint64_t* k;
+  size_t j;
+
+  *n = b->n[i];
+  k = (uint64_t*) malloc((*n > 0 ? *n : 1) * sizeof(uint64_t));
+  if(k == NULL)
+    return KMBIN_ERR;
+  if(lseek(b->fd[i], 0, SEEK_SET) != 0
+     || read_all(b->fd[i], (unsigned char*) k, *n * b->word) != KMBIN_OK)
+    {
+      free(k);
+      return KMBIN_ERR;
+    }
+  // widen the offsets in place, from the last one: an index is never
+  // written over an offset still to be read
+  if(b->word == 4)
+    for(j = *n; j-- > 0; )
+      k[j] = base + ((uint32_t*) k)[j];
+  else
+    for(j = 0; j < *n; j++)
+      k[j] += base;
+  // the disk space of the bin is no longer needed
+  close(b->fd[i]);
+  b->fd[i] = -1;
+  bin_path(b, i, path);
+  unlink(path);
+  *keys = k;
+  return KMBIN_OK;
+}
+
+void kmbin_free(kmbin_t* b)
+{
+  char path[BIN_PATH];
+  int i;
+  if(b->fd != NULL)
+    for(i = 0; i < b->bins; i++)
+      if(b->fd[i] >= 0)
+	{
+	  close(b->fd[i]);
+	  bin_path(b, i, path);
+	  unlink(path);
+	}
+  if(b->dir[0] != '\0')
+    rmdir(b->dir);
+  free(b->fd);
+  free(b->fill);
+  free(b->n);
+  free(b->buf);
+  b->fd = NULL;
+  b->fill = NULL;
+  b->n = NULL;
+  b->buf = NULL;
+  b->dir[0] = '\0';
+}
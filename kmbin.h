@@ -0,0 +1,92 @@
+/**
+ *   \file kmbin.h
+ *   \brief On-disk bins of k-mer indexes, for inputs larger than memory.
+ *
+ *  The index space is cut into a power of 2 number of bins by the high
+ *  bits of the index.  Each index is appended to the buffer of its bin,
+ *  as its offset in the bin (4 bytes when the bin is at most 2^32
+ *  entries), and a full buffer is written to the file of the bin in one
+ *  sequential write.  Once the input is read, each bin is loaded back
+ *  in turn and counted in memory: the bins come in index order.  The
+ *  files live in a directory of their own, removed by kmbin_free.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __KMBIN_H__
+#define __KMBIN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KMBIN_ERR -1   /* Memory or I/O error */
+#define KMBIN_OK 0     /* OK */
+
+#define KMBIN_PATH 4096
+
+typedef struct kmbin_s
+{
+  char dir[KMBIN_PATH];   /* directory of the bin files */
+  int* fd;
+  unsigned char* buf;     /* cap offsets per bin */
+  size_t* fill;           /* offsets held by each buffer */
+  uint64_t* n;            /* offsets written to each bin */
+  size_t cap;
+  int bins;
+  int shift;              /* index bits below the bin number */
+  int word;               /* bytes of an offset: 4 or 8 */
+} kmbin_t;
+
+/*
+ * Set up "bins" bins (a power of 2) over indexes of "bits" bits, in a
+ * new directory under tmp, with buffers of buf_bytes per bin.
+ * Return KMBIN_OK or KMBIN_ERR.
+ */
+extern int kmbin_init(kmbin_t* b, const char* tmp, int bins, int bits,
+		      size_t buf_bytes);
+
+/*
+ * Write the buffer of bin i to its file. Return KMBIN_OK or KMBIN_ERR.
+ */
+extern int kmbin_write(kmbin_t* b, int i);
+
+/*
+ * Write every buffer: the files hold all the indexes.
+ */
+extern int kmbin_flush(kmbin_t* b);
+
+/*
+ * Read bin i back into *keys (malloc'ed, *n indexes, in the order they
+ * were added) and remove its file. Return KMBIN_OK or KMBIN_ERR.
+ */
+extern int kmbin_load(kmbin_t* b, int i, uint64_t** keys, size_t* n);
+
+/*
+ * Close and remove the files and their directory.
+ */
+extern void kmbin_free(kmbin_t* b);
+
+/*
+ * Append the n indexes at "in" to their bins.
+ * Return KMBIN_OK or KMBIN_ERR.
+ */
+static inline int kmbin_add(kmbin_t* b, const uint64_t* in, long n)
+{
+  long j;
+  uint64_t p, off;
+  unsigned char* at;
+  for(j = 0; j < n; j++)
+    {
+      p = in[j] >> b->shift;
+      off = in[j] - (p << b->shift);
+      at = b->buf + (p * b->cap + b->fill[p]) * b->word;
+      if(b->word == 4)
+	*(uint32_t*) at = (uint32_t) off;
+      else
+	*(uint64_t*) at = off;
+      if(++b->fill[p] == b->cap && kmbin_write(b, p) != KMBIN_OK)
+	return KMBIN_ERR;
+    }
+  return KMBIN_OK;
+}
+
+#endif // __KMBIN_H__
@@ -0,0 +1,295 @@
+/*
+ * Rolling k-mer encoder.
+ */
+#include "kmer.h"
+#include "nucpack.h"
+
+#define X KMER_INVALID
+const unsigned char kmer_code[256] = {
+  X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+  X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+  /* @ A B C D E F G H I J K L M N O P Q R S T U V W X Y Z [ \ ] ^ _ */
+  X,0,X,1,X,X,X,2,X,X,X,X,X,X,X,X, X,X,X,X,3,X,X,X,X,X,X,X,X,X,X,X,
+  /* ` a b c d e f g h i j k l m n o p q r s t u v w x y z { | } ~   */
+  X,0,X,1,X,X,X,2,X,X,X,X,X,X,X,X, X,X,X,X,3,X,X,X,X,X,X,X,X,X,X,X,
+  X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+  X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+  X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+  X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X
+};
+#undef X
+
+/*
+ * Shift the bases "from" to "to" of a packed word into the window of r.
+ * Always inlined with a constant mode, so each mode gets its own loop.
+ */
+static inline __attribute__((always_inline))
+long roll_word(kmer_roll_t* r, uint64_t w, int from, int to, uint64_t* out,
+	       const int mode)
+{
+  long n = 0;
+  int j, k = r->k, filled = r->filled, top = 2 * (k - 1);
+  uint64_t fwd = r->fwd, rev = r->rev, mask = r->mask, code;
+  w >>= 2 * from;
+  for(j = from; j < to; j++, w >>= 2)
+    {
+      code = w & 3;
+      fwd = ((fwd << 2) | code) & mask;
+      if(mode != KMER_FORWARD)
+	rev = (rev >> 2) | ((3 - code) << top);
+      // the first k - 1 bases only load the window
+      if(filled < k - 1)
+	{
+	  filled++;
+	  continue;
+	}
+      if(mode == KMER_FORWARD)
+	out[n++] = fwd;
+      else if(mode == KMER_CANONICAL)
+	out[n++] = (rev < fwd) ? rev : fwd;
+      else
+	out[n++] = kmer_half_index(fwd, rev, k);
+    }
+  r->fwd = fwd;
+  r->rev = rev;
+  r->filled = filled;
+  return n;
+}
+
+/*
+ * Roll over bases "from" to "to" of a packed word whose invalid bases
+ * are set in "bad": every invalid one restarts the window, no window
+ * holding it is ever completed.
+ */
+static inline __attribute__((always_inline))
+long roll_span(kmer_roll_t* r, uint64_t w, uint32_t bad, int from, int to,
+	       uint64_t* out, const int mode)
+{
+  long n = 0;
+  int stop;
+  for(; bad != 0; bad &= bad - 1)
+    {
+      stop = __builtin_ctz(bad);
+      n += roll_word(r, w, from, stop, out + n, mode);
+      r->filled = 0;
+      from = stop + 1;
+    }
+  // past an invalid last base there is nothing left, and w cannot be
+  // shifted by 64 bits
+  return (from < to) ? n + roll_word(r, w, from, to, out + n, mode) : n;
+}
+
+static inline __attribute__((always_inline))
+long batch(kmer_roll_t* r, fasta_cursor_t* cur, uint64_t* out, const int mode)
+{
+  const char* line;
+  size_t len, i, left = KMER_BATCH;
+  long n = 0;
+  uint64_t words[KMER_BATCH / NUC_PER_WORD + 1];
+  uint32_t invalid[KMER_BATCH / NUC_PER_WORD + 1];
+  int m;
+
+  // roll_word counts up to k - 1 loaded bases: any further one
+  // completes a window
+  if(r->filled > r->k - 1)
+    r->filled = r->k - 1;
+  while(left > 0 && (len = fasta_cursor_line(cur, &line, left)) > 0)
+    {
+      left -= len;
+      // the rest of the record can be read ahead by the vector kernels
+      nuc_pack(line, len, cur->end - line, words, invalid);
+      for(i = 0; i < len; i += NUC_PER_WORD)
+	{
+	  m = (len - i < NUC_PER_WORD) ? len - i : NUC_PER_WORD;
+	  n += roll_span(r, words[i / NUC_PER_WORD], invalid[i / NUC_PER_WORD],
+			 0, m, out + n, mode);
+	}
+    }
+  if(left == KMER_BATCH)
+    return -1;
+  return n;
+}
+
+long kmer_batch(kmer_roll_t* r, fasta_cursor_t* cur, uint64_t* out)
+{
+  switch(r->mode) {
+  case KMER_CANONICAL:
+    return batch(r, cur, out, KMER_CANONICAL);
+  case KMER_CANONICAL_HALF:
+    return batch(r, cur, out, KMER_CANONICAL_HALF);
+  default:
+    return batch(r, cur, out, KMER_FORWARD);
+  }
+}
+
+static inline __attribute__((always_inline))
+long store_batch(kmer_roll_t* r, seqstore_cursor_t* cur, uint64_t* out,
+		 const int mode)
+{
+  const uint64_t* bases = cur->s->bases;
+  uint64_t w, stop;
+  long n = 0;
+  int from, to;
+
+  if(cur->pos >= cur->end)
+    return -1;
+  if(r->filled > r->k - 1)
+    r->filled = r->k - 1;
+  stop = (cur->end - cur->pos > KMER_BATCH) ? cur->pos + KMER_BATCH : cur->end;
+  // the bases are already packed: roll over them word by word
+  while(cur->pos < stop)
+    {
+      w = cur->pos / NUC_PER_WORD;
+      from = cur->pos % NUC_PER_WORD;
+      to = (stop - w * NUC_PER_WORD < NUC_PER_WORD) ?
+	stop - w * NUC_PER_WORD : NUC_PER_WORD;
+      n += roll_span(r, bases[w], seqstore_invalid(cur, w, from, to),
+		     from, to, out + n, mode);
+      cur->pos += to - from;
+    }
+  return n;
+}
+
+long kmer_store_batch(kmer_roll_t* r, seqstore_cursor_t* cur, uint64_t* out)
+{
+  switch(r->mode) {
+  case KMER_CANONICAL:
+    return store_batch(r, cur, out, KMER_CANONICAL);
+  case KMER_CANONICAL_HALF:
+    return store_batch(r, cur, out, KMER_CANONICAL_HALF);
+  default:
+    return store_batch(r, cur, out, KMER_FORWARD);
+  }
+}
+
+void kmer_multi_init(kmer_multi_t* m, const int* ks, const int* modes, int n)
+{
+  int j, top = 0;
+  m->n = (n < KMER_MAX_MULTI) ? n : KMER_MAX_MULTI;
+  for(j = 0; j < m->n; j++)
+    {
+      m->k[j] = ks[j];
+      m->mode[j] = modes[j];
+      m->mask[j] = (1ULL << (2 * ks[j])) - 1;
+      if(ks[j] > top)
+	top = ks[j];
+    }
+  kmer_roll_init(&m->roll, top, KMER_FORWARD);
+}
+
+/*
+ * Shift the bases "from" to "to" of a packed word into the window, then
+ * store the index of every k-mer completed, one k after the other so
+ * that each gets a tight loop.
+ */
+static void multi_word(kmer_multi_t* m, uint64_t w, int from, int to,
+		       uint64_t* out, long* count)
+{
+  kmer_roll_t* r = &m->roll;
+  int i, j, n = to - from, top = 2 * (r->k - 1), shift;
+  int filled[NUC_PER_WORD];
+  uint64_t fwd[NUC_PER_WORD], rev[NUC_PER_WORD], f, b, mask, *o;
+  uint64_t wf = r->fwd, wr = r->rev, code;
+  w >>= 2 * from;
+  for(i = 0; i < n; i++, w >>= 2)
+    {
+      code = w & 3;
+      wf = ((wf << 2) | code) & r->mask;
+      wr = (wr >> 2) | ((3 - code) << top);
+      if(r->filled < r->k)
+	r->filled++;
+      fwd[i] = wf;
+      rev[i] = wr;
+      filled[i] = r->filled;
+    }
+  r->fwd = wf;
+  r->rev = wr;
+  for(j = 0; j < m->n; j++)
+    {
+      // the last k bases, and their reverse complement at the top
+      o = out + j * KMER_BATCH + count[j];
+      mask = m->mask[j];
+      shift = 2 * (r->k - m->k[j]);
+      // the window only grows within a word
+      for(i = 0; i < n && filled[i] < m->k[j]; i++)
+	;
+      if(m->mode[j] == KMER_FORWARD)
+	for(; i < n; i++)
+	  *o++ = fwd[i] & mask;
+      else if(m->mode[j] == KMER_CANONICAL)
+	for(; i < n; i++)
+	  {
+	    f = fwd[i] & mask;
+	    b = rev[i] >> shift;
+	    *o++ = (b < f) ? b : f;
+	  }
+      else
+	for(; i < n; i++)
+	  *o++ = kmer_half_index(fwd[i] & mask, rev[i] >> shift, m->k[j]);
+      count[j] = o - out - j * KMER_BATCH;
+    }
+}
+
+static void multi_span(kmer_multi_t* m, uint64_t w, uint32_t bad, int from,
+		       int to, uint64_t* out, long* count)
+{
+  int stop;
+  for(; bad != 0; bad &= bad - 1)
+    {
+      stop = __builtin_ctz(bad);
+      multi_word(m, w, from, stop, out, count);
+      m->roll.filled = 0;
+      from = stop + 1;
+    }
+  multi_word(m, w, from, to, out, count);
+}
+
+int kmer_multi_batch(kmer_multi_t* m, fasta_cursor_t* cur, uint64_t* out,
+		     long* count)
+{
+  const char* line;
+  size_t len, i, left = KMER_BATCH;
+  uint64_t words[KMER_BATCH / NUC_PER_WORD + 1];
+  uint32_t invalid[KMER_BATCH / NUC_PER_WORD + 1];
+  int j, n;
+
+  for(j = 0; j < m->n; j++)
+    count[j] = 0;
+  while(left > 0 && (len = fasta_cursor_line(cur, &line, left)) > 0)
+    {
+      left -= len;
+      nuc_pack(line, len, cur->end - line, words, invalid);
+      for(i = 0; i < len; i += NUC_PER_WORD)
+	{
+	  n = (len - i < NUC_PER_WORD) ? len - i : NUC_PER_WORD;
+	  multi_span(m, words[i / NUC_PER_WORD], invalid[i / NUC_PER_WORD],
+		     0, n, out, count);
+	}
+    }
+  return (left == KMER_BATCH) ? -1 : 0;
+}
+
+int kmer_multi_store_batch(kmer_multi_t* m, seqstore_cursor_t* cur,
+			   uint64_t* out, long* count)
+{
+  const uint64_t* bases = cur->s->bases;
+  uint64_t w, stop;
+  int j, from, to;
+
+  for(j = 0; j < m->n; j++)
+    count[j] = 0;
+  if(cur->pos >= cur->end)
+    return -1;
+  stop = (cur->end - cur->pos > KMER_BATCH) ? cur->pos + KMER_BATCH : cur->end;
+  while(cur->pos < stop)
+    {
+      w = cur->pos / NUC_PER_WORD;
+      from = cur->pos % NUC_PER_WORD;
+      to = (stop - w * NUC_PER_WORD < NUC_PER_WORD) ?
+	stop - w * NUC_PER_WORD : NUC_PER_WORD;
+      multi_span(m, bases[w], seqstore_invalid(cur, w, from, to),
+		 from, to, out, count);
+      cur->pos += to - from;
+    }
+  return 0;
+}
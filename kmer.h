@@ -0,0 +1,219 @@
+/**
+ *   \file kmer.h
+ *   \brief Rolling 2-bit k-mer encoder.
+ *
+ *  A k-mer index is the base-4 number made of its bases, the first base
+ *  in the high bits (A=0, C=1, G=2, T=3): the same index get_index
+ *  computes.  The encoder keeps the index of the last k bases and
+ *  updates it with one shift per base instead of re-reading the k bases
+ *  of every window.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __KMER_H__
+#define __KMER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fasta.h"
+#include "seqstore.h"
+
+#define KMER_MAX_K 32       /* k-mers that fit in 64 bits */
+#define KMER_BATCH 1024     /* bases (and k-mers) handled per kmer_batch */
+#define KMER_INVALID 4      /* kmer_code of a byte that is not a base */
+
+/* What kmer_batch reports for each window */
+#define KMER_FORWARD 0          /* index of the k-mer as read */
+#define KMER_CANONICAL 1        /* min(index, reverse complement index) */
+#define KMER_CANONICAL_HALF 2   /* dense canonical index, odd k only */
+
+/*
+ * 2-bit code of every byte, in any case, or KMER_INVALID.
+ */
+extern const unsigned char kmer_code[256];
+
+/*
+ * Encoder state: the index of the last k bases read (and of their
+ * reverse complement) and how many bases of the current window are
+ * loaded.
+ */
+typedef struct kmer_roll_s
+{
+  uint64_t fwd;
+  uint64_t rev;
+  uint64_t mask;
+  int k;
+  int filled;
+  int mode;
+} kmer_roll_t;
+
+static inline void kmer_roll_reset(kmer_roll_t* r)
+{
+  r->fwd = 0;
+  r->rev = 0;
+  r->filled = 0;
+}
+
+/*
+ * Set up an encoder of k-mers reported as "mode" (KMER_FORWARD, ...).
+ */
+static inline void kmer_roll_init(kmer_roll_t* r, int k, int mode)
+{
+  r->k = k;
+  r->mask = (k >= KMER_MAX_K) ? ~0ULL : (1ULL << (2 * k)) - 1;
+  r->mode = mode;
+  kmer_roll_reset(r);
+}
+
+/*
+ * Index of the reverse complement of the k-mer x.
+ */
+static inline uint64_t kmer_revcomp(uint64_t x, int k)
+{
+  // complement, then reverse the order of the 2-bit groups
+  x = ~x;
+  x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  x = __builtin_bswap64(x);
+  return x >> (64 - 2 * k);
+}
+
+/*
+ * Canonical form (smaller index of both strands) of the k-mer x.
+ */
+static inline uint64_t kmer_canonical(uint64_t x, int k)
+{
+  uint64_t rc = kmer_revcomp(x, k);
+  return (rc < x) ? rc : x;
+}
+
+/*
+ * Dense canonical index of the k-mer with strands fwd and rev (odd k).
+ */
+static inline uint64_t kmer_half_index(uint64_t fwd, uint64_t rev, int k)
+{
+  int hb = k;   // high bit of the middle base: 2 * (k / 2) + 1
+  uint64_t x = ((fwd >> hb) & 1) ? rev : fwd;
+  return ((x >> (hb + 1)) << hb) | (x & ((1ULL << hb) - 1));
+}
+
+/*
+ * Strand with A or C in the middle of the k-mer of dense index i.
+ */
+static inline uint64_t kmer_half_decode(uint64_t i, int k)
+{
+  int hb = k;
+  return ((i >> hb) << (hb + 1)) | (i & ((1ULL << hb) - 1));
+}
+
+/*
+ * Number of distinct indexes reported for k-mers in "mode".
+ */
+static inline uint64_t kmer_space(int k, int mode)
+{
+  uint64_t n = 1ULL << (2 * k);
+  return (mode == KMER_CANONICAL_HALF) ? n / 2 : n;
+}
+
+/*
+ * Shift one base into the window. Return 1 when r->fwd (and r->rev)
+ * hold the index of a complete k-mer. An invalid base empties the
+ * window.
+ */
+static inline int kmer_roll(kmer_roll_t* r, unsigned char base)
+{
+  unsigned code = kmer_code[base];
+  if(code == KMER_INVALID)
+    {
+      r->filled = 0;
+      return 0;
+    }
+  r->fwd = ((r->fwd << 2) | code) & r->mask;
+  r->rev = (r->rev >> 2) | ((uint64_t)(3 - code) << (2 * (r->k - 1)));
+  if(r->filled < r->k)
+    return ++r->filled == r->k;
+  return 1;
+}
+
+/*
+ * Compute the index of the k bases at sq from scratch.
+ * Return 0 if they hold an invalid base.
+ */
+static inline int kmer_encode(const char* sq, int k, uint64_t* index)
+{
+  unsigned code;
+  int i;
+  *index = 0;
+  for(i = 0; i < k; i++)
+    {
+      code = kmer_code[(unsigned char) sq[i]];
+      if(code == KMER_INVALID)
+	return 0;
+      *index = (*index << 2) | code;
+    }
+  return 1;
+}
+
+/*
+ * Read up to KMER_BATCH bases from the cursor, continuing the window of
+ * r, and store in out the index of every k-mer completed, as selected
+ * by the mode of r. Bases are
+ * packed with nuc_pack first and shifted in from the packed words; the
+ * invalid mask of each word gives the positions where the window
+ * restarts.
+ * Return the number of indexes stored, or -1 when the cursor is
+ * exhausted.
+ */
+extern long kmer_batch(kmer_roll_t* r, fasta_cursor_t* cur, uint64_t* out);
+
+/*
+ * Same as kmer_batch, reading the bases of a record of a packed store.
+ */
+extern long kmer_store_batch(kmer_roll_t* r, seqstore_cursor_t* cur,
+			     uint64_t* out);
+
+/*
+ * Encoder of several k at once: the window of the largest k is rolled
+ * and the index of each smaller k-mer ending at the same base is taken
+ * from its low bits (and the top bits of its reverse complement).
+ */
+#define KMER_MAX_MULTI 8
+
+typedef struct kmer_multi_s
+{
+  kmer_roll_t roll;           /* window of the largest k, filled up to k */
+  int n;
+  int k[KMER_MAX_MULTI];
+  int mode[KMER_MAX_MULTI];
+  uint64_t mask[KMER_MAX_MULTI];
+} kmer_multi_t;
+
+/*
+ * Set up an encoder of the n values of k at ks (each below KMER_MAX_K),
+ * k-mer j reported as modes[j].
+ */
+extern void kmer_multi_init(kmer_multi_t* m, const int* ks,
+			    const int* modes, int n);
+
+static inline void kmer_multi_reset(kmer_multi_t* m)
+{
+  kmer_roll_reset(&m->roll);
+}
+
+/*
+ * Same as kmer_batch for every k: the indexes of k-mer j go to
+ * out + j * KMER_BATCH, their number to count[j]. Return 0, or -1 when
+ * the cursor is exhausted.
+ */
+extern int kmer_multi_batch(kmer_multi_t* m, fasta_cursor_t* cur,
+			    uint64_t* out, long* count);
+
+/*
+ * Same as kmer_multi_batch, reading the bases of a record of a packed
+ * store.
+ */
+extern int kmer_multi_store_batch(kmer_multi_t* m, seqstore_cursor_t* cur,
+				  uint64_t* out, long* count);
+
+#endif // __KMER_H__
@@ -0,0 +1,270 @@
+/*
+ * Sort-and-count k-mer counter.
+ */
+#include "kmsort.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define DIGIT_BITS 8
+#define DIGITS (1 << DIGIT_BITS)
+#define MIN_SORT (1 << 16)   /* do not split below this many keys per thread */
+
+typedef struct sort_job_s
+{
+  const uint64_t* src;
+  uint64_t* dst;
+  size_t lo, hi;          /* keys of the job */
+  int shift;              /* digit of the pass */
+  size_t count[DIGITS];   /* keys of each digit, then where they go */
+  int running;
+  pthread_t tid;
+} sort_job_t;
+
+static void* count_digits(void* arg)
+{
+  sort_job_t* job = (sort_job_t*) arg;
+  size_t i;
+  memset(job->count, 0, sizeof(job->count));
+  for(i = job->lo; i < job->hi; i++)
+    job->count[(job->src[i] >> job->shift) & (DIGITS - 1)]++;
+  return NULL;
+}
+
+static void* scatter(void* arg)
+{
+  sort_job_t* job = (sort_job_t*) arg;
+  size_t i;
+  uint64_t x;
+  for(i = job->lo; i < job->hi; i++)
+    {
+      x = job->src[i];
+      job->dst[job->count[(x >> job->shift) & (DIGITS - 1)]++] = x;
+    }
+  return NULL;
+}
+
+/*
+ * Run fn on every job, job 0 (and any job whose thread cannot be
+ * started) on the calling thread.
+ */
+static void run_jobs(sort_job_t* jobs, int n, void* (*fn)(void*))
+{
+  int t;
+  for(t = 1; t < n; t++)
+    jobs[t].running = (pthread_create(&jobs[t].tid, NULL, fn, &jobs[t]) == 0);
+  jobs[0].running = 0;
+  for(t = 0; t < n; t++)
+    if(!jobs[t].running)
+      fn(&jobs[t]);
+  for(t = 1; t < n; t++)
+    if(jobs[t].running)
+      pthread_join(jobs[t].tid, NULL);
+}
+
+/*
+ * Sort the s->n keys of s->buf, one digit per pass, each thread
+ * scattering its part of the keys in order: the sort is stable.
+ */
+static void radix_sort(kmsort_t* s)
+{
+  int nthreads = s->nthreads, t, d, shift;
+  size_t pos, i;
+  uint64_t* p;
+
+  if(nthreads > s->n / MIN_SORT + 1)
+    nthreads = s->n / MIN_SORT + 1;
+  sort_job_t jobs[nthreads];
+  for(t = 0; t < nthreads; t++)
+    {
+      jobs[t].lo = s->n * t / nthreads;
+      jobs[t].hi = s->n * (t + 1) / nthreads;
+    }
+  for(shift = 0; shift < s->bits; shift += DIGIT_BITS)
+    {
+      for(t = 0; t < nthreads; t++)
+	{
+	  jobs[t].src = s->buf;
+	  jobs[t].dst = s->tmp;
+	  jobs[t].shift = shift;
+	}
+      run_jobs(jobs, nthreads, count_digits);
+      // keys of digit d from thread t go after those of the threads
+      // before it; a digit shared by every key needs no pass
+      for(d = 0, pos = 0; d < DIGITS; d++)
+	for(t = 0; t < nthreads; t++)
+	  {
+	    i = jobs[t].count[d];
+	    jobs[t].count[d] = pos;
+	    pos += i;
+	  }
+      for(d = 0; d < DIGITS; d++)
+	if(jobs[0].count[d] == 0 && (d == DIGITS - 1
+				     ? s->n : jobs[0].count[d + 1]) == s->n)
+	  break;
+      if(d < DIGITS)
+	continue;
+      run_jobs(jobs, nthreads, scatter);
+      p = s->buf;
+      s->buf = s->tmp;
+      s->tmp = p;
+    }
+}
+
+int kmsort_init(kmsort_t* s, int bits, size_t cap, int nthreads)
+{
+  s->bits = bits;
+  s->cap = (cap > 0) ? cap : 1;
+  s->nthreads = (nthreads > 0) ? nthreads : 1;
+  s->n = 0;
+  s->runs = NULL;
+  s->n_runs = 0;
+  s->buf = (uint64_t*) malloc(s->cap * sizeof(uint64_t));
+  s->tmp = (uint64_t*) malloc(s->cap * sizeof(uint64_t));
+  if(s->buf == NULL || s->tmp == NULL)
+    {
+      kmsort_free(s);
+      return KMSORT_ERR;
+    }
+  return KMSORT_OK;
+}
+
+int kmsort_batch(kmsort_t* s)
+{
+  kmsort_run_t* runs;
+  kmsort_run_t* r;
+  size_t i, j, n;
+
+  if(s->n == 0)
+    return KMSORT_OK;
+  radix_sort(s);
+  for(i = 1, n = 1; i < s->n; i++)
+    n += (s->buf[i] != s->buf[i - 1]);
+  runs = (kmsort_run_t*) realloc(s->runs,
+				 (s->n_runs + 1) * sizeof(kmsort_run_t));
+  if(runs == NULL)
+    return KMSORT_ERR;
+  s->runs = runs;
+  r = &runs[s->n_runs];
+  r->keys = (uint64_t*) malloc(n * sizeof(uint64_t));
+  r->counts = (unsigned int*) malloc(n * sizeof(unsigned int));
+  if(r->keys == NULL || r->counts == NULL)
+    {
+      free(r->keys);
+      free(r->counts);
+      return KMSORT_ERR;
+    }
+  r->n = n;
+  s->n_runs++;
+  // run-length count the sorted keys
+  r->keys[0] = s->buf[0];
+  r->counts[0] = 1;
+  for(i = 1, j = 0; i < s->n; i++)
+    if(s->buf[i] == r->keys[j])
+      r->counts[j]++;
+    else
+      {
+	r->keys[++j] = s->buf[i];
+	r->counts[j] = 1;
+      }
+  s->n = 0;
+  return KMSORT_OK;
+}
+
+/*
+ * Key at the head of run r.
+ */
+static inline uint64_t head_key(const kmsort_t* s, const size_t* head,
+				size_t r)
+{
+  return s->runs[r].keys[head[r]];
+}
+
+/*
+ * Move heap[i] down the min-heap of n runs, ordered by head key.
+ */
+static void sift_down(const kmsort_t* s, const size_t* head, size_t* heap,
+		      size_t n, size_t i)
+{
+  size_t child, r = heap[i];
+  for(; (child = 2 * i + 1) < n; i = child)
+    {
+      if(child + 1 < n
+	 && head_key(s, head, heap[child + 1]) < head_key(s, head, heap[child]))
+	child++;
+      if(head_key(s, head, r) <= head_key(s, head, heap[child]))
+	break;
+      heap[i] = heap[child];
+    }
+  heap[i] = r;
+}
+
+int kmsort_iterate(kmsort_t* s, kmsort_fn f, void* item)
+{
+  size_t r, n;
+  size_t* head;
+  size_t* heap;
+  uint64_t key;
+  unsigned int count;
+  int err = KMSORT_OK;
+
+  if(kmsort_batch(s) != KMSORT_OK)
+    return KMSORT_ERR;
+  free(s->buf);
+  free(s->tmp);
+  s->buf = s->tmp = NULL;
+  s->n = s->cap = 0;
+
+  // the runs grow with the input (one per batch): the smallest head is
+  // taken from a min-heap of the runs not yet exhausted
+  head = (size_t*) malloc((s->n_runs + 1) * sizeof(size_t));
+  heap = (size_t*) malloc((s->n_runs + 1) * sizeof(size_t));
+  if(head == NULL || heap == NULL)
+    {
+      free(head);
+      free(heap);
+      return KMSORT_ERR;
+    }
+  for(r = 0, n = 0; r < s->n_runs; r++)
+    {
+      head[r] = 0;
+      if(s->runs[r].n > 0)
+	heap[n++] = r;
+    }
+  for(r = n / 2; r-- > 0;)
+    sift_down(s, head, heap, n, r);
+  while(n > 0 && err == KMSORT_OK)
+    {
+      key = head_key(s, head, heap[0]);
+      count = 0;
+      while(n > 0 && head_key(s, head, heap[0]) == key)
+	{
+	  r = heap[0];
+	  count += s->runs[r].counts[head[r]++];
+	  if(head[r] == s->runs[r].n)
+	    heap[0] = heap[--n];
+	  if(n > 0)
+	    sift_down(s, head, heap, n, 0);
+	}
+      err = f(item, key, count);
+    }
+  free(head);
+  free(heap);
+  return err;
+}
+
+void kmsort_free(kmsort_t* s)
+{
+  size_t r;
+  for(r = 0; r < s->n_runs; r++)
+    {
+      free(s->runs[r].keys);
+      free(s->runs[r].counts);
+    }
+  free(s->runs);
+  free(s->buf);
+  free(s->tmp);
+  s->runs = NULL;
+  s->buf = s->tmp = NULL;
+  s->n_runs = s->n = s->cap = 0;
+}
@@ -0,0 +1,94 @@
+/**
+ *   \file kmsort.h
+ *   \brief Sort-and-count k-mer counter.
+ *
+ *  For k-mer spectra too sparse for a dense vector: the indexes of the
+ *  k-mers are appended to a buffer, which is sorted with a parallel LSD
+ *  radix sort (8 bits per pass, passes where every key has the same
+ *  digit are skipped) and run-length counted.  Memory is proportional
+ *  to the number of k-mers of a batch: a full buffer is sorted and
+ *  counted into a run, and the runs are merged when the counts are
+ *  read, in index order, through a min-heap of their next keys.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __KMSORT_H__
+#define __KMSORT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define KMSORT_ERR -1   /* Memory error */
+#define KMSORT_OK 0     /* OK */
+
+/*
+ * Distinct indexes of a sorted batch and their counts.
+ */
+typedef struct kmsort_run_s
+{
+  uint64_t* keys;
+  unsigned int* counts;
+  size_t n;
+} kmsort_run_t;
+
+typedef struct kmsort_s
+{
+  uint64_t* buf;        /* indexes of the current batch */
+  uint64_t* tmp;        /* radix sort scratch, as large as buf */
+  size_t n;
+  size_t cap;           /* indexes of a batch */
+  int bits;             /* significant bits of an index */
+  int nthreads;
+  kmsort_run_t* runs;
+  size_t n_runs;
+} kmsort_t;
+
+/*
+ * Called with (item, index, count) for every index counted, in index
+ * order. Anything but KMSORT_OK stops the traversal.
+ */
+typedef int (*kmsort_fn)(void* item, uint64_t index, unsigned int count);
+
+/*
+ * Set up a counter of indexes of "bits" bits, sorted by batches of
+ * "cap" indexes with up to nthreads threads.
+ * Return KMSORT_OK or KMSORT_ERR.
+ */
+extern int kmsort_init(kmsort_t* s, int bits, size_t cap, int nthreads);
+
+/*
+ * Sort and count the indexes buffered into a new run.
+ * Return KMSORT_OK or KMSORT_ERR.
+ */
+extern int kmsort_batch(kmsort_t* s);
+
+/*
+ * Count the last batch and call f for every index, merging the runs.
+ * The buffers are released first. Return KMSORT_OK, KMSORT_ERR or what
+ * stopped f.
+ */
+extern int kmsort_iterate(kmsort_t* s, kmsort_fn f, void* item);
+
+extern void kmsort_free(kmsort_t* s);
+
+/*
+ * Add the n indexes at "in". Return KMSORT_OK or KMSORT_ERR.
+ */
+static inline int kmsort_add(kmsort_t* s, const uint64_t* in, size_t n)
+{
+  size_t m;
+  while(n > 0)
+    {
+      m = (n < s->cap - s->n) ? n : s->cap - s->n;
+      memcpy(s->buf + s->n, in, m * sizeof(uint64_t));
+      s->n += m;
+      in += m;
+      n -= m;
+      if(s->n == s->cap && kmsort_batch(s) != KMSORT_OK)
+	return KMSORT_ERR;
+    }
+  return KMSORT_OK;
+}
+
+#endif // __KMSORT_H__
@@ -0,0 +1,130 @@
+/*
+ * Abundance spectrum and top N k-mers of a histogram.
+ */
+#include "kmstat.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+int kmstat_spectrum_init(kmstat_spectrum_t* s)
+{
+  s->big = NULL;
+  s->n_big = s->cap_big = 0;
+  s->err = KMSTAT_OK;
+  s->dense = (uint64_t*) calloc(KMSTAT_DENSE, sizeof(uint64_t));
+  return s->dense ? KMSTAT_OK : KMSTAT_ERR;
+}
+
+void kmstat_spectrum_free(kmstat_spectrum_t* s)
+{
+  free(s->dense);
+  free(s->big);
+  s->dense = s->big = NULL;
+}
+
+void kmstat_spectrum_clear(kmstat_spectrum_t* s)
+{
+  memset(s->dense, 0, KMSTAT_DENSE * sizeof(uint64_t));
+  s->n_big = 0;
+  s->err = KMSTAT_OK;
+}
+
+int kmstat_spectrum_reserve(kmstat_spectrum_t* s, size_t n)
+{
+  uint64_t* big;
+  if(n <= s->cap_big)
+    return KMSTAT_OK;
+  big = (uint64_t*) realloc(s->big, n * sizeof(uint64_t));
+  if(big == NULL)
+    return KMSTAT_ERR;
+  s->big = big;
+  s->cap_big = n;
+  return KMSTAT_OK;
+}
+
+static int cmp_count(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+int kmstat_spectrum_write(kmstat_spectrum_t* s, FILE* outfp)
+{
+  size_t c, i, j;
+  if(s->err != KMSTAT_OK)
+    return KMSTAT_ERR;
+  for(c = 1; c < KMSTAT_DENSE; c++)
+    if(s->dense[c] != 0)
+      fprintf(outfp, "%10zu %10" PRIu64 "\n", c, s->dense[c]);
+  qsort(s->big, s->n_big, sizeof(uint64_t), cmp_count);
+  for(i = 0; i < s->n_big; i = j)
+    {
+      for(j = i + 1; j < s->n_big && s->big[j] == s->big[i]; j++)
+	;
+      fprintf(outfp, "%10" PRIu64 " %10zu\n", s->big[i], j - i);
+    }
+  return KMSTAT_OK;
+}
+
+int kmstat_top_init(kmstat_top_t* t, size_t cap)
+{
+  t->n = 0;
+  t->cap = cap;
+  t->heap = (kmstat_pair_t*) malloc((cap ? cap : 1) * sizeof(kmstat_pair_t));
+  return t->heap ? KMSTAT_OK : KMSTAT_ERR;
+}
+
+void kmstat_top_free(kmstat_top_t* t)
+{
+  free(t->heap);
+  t->heap = NULL;
+  t->n = 0;
+}
+
+/*
+ * Whether heap entry a ranks after b: the worse one goes up.
+ */
+static inline int after(const kmstat_pair_t* a, const kmstat_pair_t* b)
+{
+  return kmstat_before(b->index, b->count, a->index, a->count);
+}
+
+void kmstat_top_push(kmstat_top_t* t, uint64_t index, uint64_t count)
+{
+  kmstat_pair_t* h = t->heap;
+  kmstat_pair_t x = { index, count };
+  size_t i, child;
+  if(t->n < t->cap)
+    {
+      // sift up from a new leaf
+      for(i = t->n++; i > 0 && after(&x, &h[(i - 1) / 2]); i = (i - 1) / 2)
+	h[i] = h[(i - 1) / 2];
+      h[i] = x;
+      return;
+    }
+  // replace the root and sift down
+  for(i = 0; (child = 2 * i + 1) < t->n; i = child)
+    {
+      if(child + 1 < t->n && after(&h[child + 1], &h[child]))
+	child++;
+      if(!after(&h[child], &x))
+	break;
+      h[i] = h[child];
+    }
+  h[i] = x;
+}
+
+static int cmp_rank(const void* a, const void* b)
+{
+  const kmstat_pair_t* x = (const kmstat_pair_t*) a;
+  const kmstat_pair_t* y = (const kmstat_pair_t*) b;
+  if(kmstat_before(x->index, x->count, y->index, y->count))
+    return -1;
+  return kmstat_before(y->index, y->count, x->index, x->count);
+}
+
+void kmstat_top_sort(kmstat_top_t* t)
+{
+  qsort(t->heap, t->n, sizeof(kmstat_pair_t), cmp_rank);
+}
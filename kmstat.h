@@ -0,0 +1,130 @@
+/**
+ *   \file kmstat.h
+ *   \brief Summaries of a k-mer histogram: abundance spectrum and top N.
+ *
+ *  Both are gathered while the histogram is scanned, instead of writing
+ *  every k-mer.  The spectrum counts the k-mers seen c times for each
+ *  count c: a dense array below KMSTAT_DENSE, and the few larger counts
+ *  listed one per k-mer, run-length counted when written.  The top N
+ *  k-mers are kept in a min-heap of N entries: a k-mer that does not
+ *  beat the root is rejected with one comparison.  Ties are broken by
+ *  the smaller index, so partial results (of passes, bins or
+ *  processes) merge into the same N k-mers in any order.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __KMSTAT_H__
+#define __KMSTAT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define KMSTAT_ERR -1   /* Memory error */
+#define KMSTAT_OK 0     /* OK */
+
+#define KMSTAT_DENSE (1 << 16)   /* counts kept in the dense spectrum */
+
+typedef struct kmstat_spectrum_s
+{
+  uint64_t* dense;   /* dense[c]: k-mers counted c times */
+  uint64_t* big;     /* counts from KMSTAT_DENSE on, one per k-mer */
+  size_t n_big, cap_big;
+  int err;           /* KMSTAT_ERR once big could not grow */
+} kmstat_spectrum_t;
+
+typedef struct kmstat_pair_s
+{
+  uint64_t index;
+  uint64_t count;
+} kmstat_pair_t;
+
+typedef struct kmstat_top_s
+{
+  kmstat_pair_t* heap;   /* the worst of the n kept at heap[0] */
+  size_t n, cap;
+} kmstat_top_t;
+
+/*
+ * Set up an empty spectrum. Return KMSTAT_OK or KMSTAT_ERR.
+ */
+extern int kmstat_spectrum_init(kmstat_spectrum_t* s);
+
+extern void kmstat_spectrum_free(kmstat_spectrum_t* s);
+
+extern void kmstat_spectrum_clear(kmstat_spectrum_t* s);
+
+/*
+ * Make room for n counts in the list of large ones.
+ * Return KMSTAT_OK or KMSTAT_ERR.
+ */
+extern int kmstat_spectrum_reserve(kmstat_spectrum_t* s, size_t n);
+
+/*
+ * Write one "count k-mers" line per count seen, in increasing count.
+ * Return KMSTAT_OK, or KMSTAT_ERR when the list of large counts could
+ * not grow while it was filled.
+ */
+extern int kmstat_spectrum_write(kmstat_spectrum_t* s, FILE* outfp);
+
+/*
+ * Count one k-mer seen "count" times (not zero).
+ */
+static inline void kmstat_spectrum_add(kmstat_spectrum_t* s, uint64_t count)
+{
+  if(count < KMSTAT_DENSE)
+    {
+      s->dense[count]++;
+      return;
+    }
+  if(s->n_big == s->cap_big
+     && kmstat_spectrum_reserve(s, 2 * s->cap_big + 1024) != KMSTAT_OK)
+    {
+      s->err = KMSTAT_ERR;
+      return;
+    }
+  s->big[s->n_big++] = count;
+}
+
+/*
+ * Set up an empty top of up to cap k-mers. Return KMSTAT_OK or
+ * KMSTAT_ERR.
+ */
+extern int kmstat_top_init(kmstat_top_t* t, size_t cap);
+
+extern void kmstat_top_free(kmstat_top_t* t);
+
+/*
+ * Put the k-mer of index in the heap in place of its root.
+ */
+extern void kmstat_top_push(kmstat_top_t* t, uint64_t index, uint64_t count);
+
+/*
+ * Order the k-mers kept by decreasing count (increasing index among
+ * equal counts), in t->heap[0 .. t->n). t is no longer a heap: no
+ * k-mer can be added after.
+ */
+extern void kmstat_top_sort(kmstat_top_t* t);
+
+/*
+ * Whether the k-mer (i, c) ranks before (j, d).
+ */
+static inline int kmstat_before(uint64_t i, uint64_t c, uint64_t j, uint64_t d)
+{
+  return c > d || (c == d && i < j);
+}
+
+/*
+ * Offer the k-mer of index, counted "count" times, to the top.
+ */
+static inline void kmstat_top_add(kmstat_top_t* t, uint64_t index,
+				  uint64_t count)
+{
+  if(t->n == t->cap
+     && (t->cap == 0 || !kmstat_before(index, count, t->heap[0].index,
+				       t->heap[0].count)))
+    return;
+  kmstat_top_push(t, index, count);
+}
+
+#endif // __KMSTAT_H__
@@ -1,13 +1,27 @@
 /**
- *   \file histo-vector.c
+ *   \file mpi-IO-histo-vector.c
  *   \brief Creates a histogram from a "fna" or "fasta" file.
  *
  *  Detailed description
  *  This program creates an histogram form a "fna" or "fasta" file 
  *  using a vector to represent the histogram array.  
  *  
- *  Compile: gcc -Wall -o histo-vector histo-vector.c -lm
- *  Usage: ./histo-vector Test_Bancomini.fna 15 out.dat
+ *  Compile: mpicc -Wall -o mpi-IO-histo-vector mpi-IO-histo-vector.c fasta.c kmer.c nucpack.c seqstore.c hugemem.c kmstat.c -lm -pthread
+ *  Usage: mpirun -np 4 ./mpi-IO-histo-vector Test_Bancomini.fna 15 out.dat
+ *
+ *  Options:
+ *    -t, --threads  number of threads parsing and packing the input on
+ *                   process 0, unless an up to date <file>.sqs cache
+ *                   (see histo-vector --cache) is mapped instead
+ *    -c, --canonical  count each k-mer together with its reverse
+ *                   complement, reported as the smaller of both; for odd
+ *                   k the index space split among processes is halved
+ *    -A, --spectrum instead of the counts of the k-mers, write to
+ *                   <outfile> how many k-mers have each count, merged
+ *                   from the spectra of all processes (kmstat.h)
+ *    -N, --top      instead of the counts of the k-mers, write to
+ *                   <outfile> the N most abundant ones, merged from the
+ *                   N best of each process
  *
  *   \Author: Danny Múnera - Parallel Programing UdeA 
  */
@@ -19,24 +33,43 @@
 #include <sys/time.h>
 #include <mpi.h>
 #include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "fasta.h"
+#include "kmer.h"
+#include "seqstore.h"
+#include "hugemem.h"
+#include "kmstat.h"
 
-#define MAX_SQ 5000
-#define MAX_LINE 1000
+#define MAX_BCAST (1 << 30)
 
 //#define DEBUG
 
-int process_all_sq (char** all, size_t sq_num, int k_mers,
-		     unsigned int* histogram, int low, int high);
-void get_index(char* sq, size_t sz, long long * index);
+int process_all_sq (const seqstore_t* store, int k_mers, int mode,
+		     unsigned int* histogram, long long low, long long high);
+void bcast_bytes (void* buf, long long size, MPI_Comm c);
+void merge_report (kmstat_spectrum_t* spectrum, kmstat_top_t* top, int myr,
+		   int c_size, MPI_Comm c);
+void write_report (const char* out_file, kmstat_spectrum_t* spectrum,
+		   kmstat_top_t* top, int k_mers);
 void get_char(char* sq, size_t sz, long long index);
+long long kmer_of_index(long long index, int k_mers, int mode);
   
+static struct option long_opts[] = {
+  {"threads", required_argument, NULL, 't'},
+  {"canonical", no_argument, NULL, 'c'},
+  {"spectrum", no_argument, NULL, 'A'},
+  {"top", required_argument, NULL, 'N'},
+  {NULL, 0, NULL, 0}
+};
+
 int main(int argc, char *argv[])
 {
   char in_file[200];
   char out_file[200];
   int k_mers;
-  char sq_buffer[MAX_SQ], temp_buf[MAX_LINE];
-  size_t sq_len, ln_len, i;
+  size_t i;
   //struct timeval t1, t2;
   //double elapsedTime;
   int c_size, myr;
@@ -46,23 +79,55 @@ int main(int argc, char *argv[])
   MPI_Comm_size(c, &c_size);
   MPI_Comm_rank(c, &myr);
 
-  if (argc != 4)
+  int opt, nthreads = 1, canonical = 0, want_spectrum = 0;
+  long long top_n = -1;
+  while ((opt = getopt_long(argc, argv, "t:cAN:", long_opts, NULL)) != -1)
+    {
+      switch (opt) {
+      case 't':
+	nthreads = strtol(optarg, NULL, 10);
+	break;
+      case 'c':
+	canonical = 1;
+	break;
+      case 'A':
+	want_spectrum = 1;
+	break;
+      case 'N':
+	top_n = strtoll(optarg, NULL, 10);
+	if (top_n < 1)
+	  argc = 0;
+	break;
+      default:
+	argc = 0; // print usage
+	break;
+      }
+    }
+  if (argc - optind != 3 || (want_spectrum && top_n > 0))
     {
-      fprintf(stderr, "ERROR - usage: histo <file> k_mers <outfile>\n");
+      fprintf(stderr, "ERROR - usage: histo [--threads N] [--canonical] [--spectrum | --top N] <file> k_mers <outfile>\n");
       exit(1);
     }
 
-  strcpy(in_file, argv[1]);
-  k_mers = strtol(argv[2], NULL, 10);
-  strcpy(out_file, argv[3]);
+  strcpy(in_file, argv[optind]);
+  k_mers = strtol(argv[optind + 1], NULL, 10);
+  strcpy(out_file, argv[optind + 2]);
   
   // Each process creates a vector
   // using unsigned ints to keep the frequency of the histogram
-  long long max_ent = pow(4, k_mers);
-  // each process reports my_ent entries to the histogram 
-  long long my_ent = max_ent / c_size;
-  unsigned int* histogram = (unsigned int*) calloc (my_ent,
-						    sizeof(unsigned int));
+  // canonical k-mers of odd length have a dense index in half the space
+  int mode = KMER_FORWARD;
+  if (canonical)
+    mode = (k_mers % 2) ? KMER_CANONICAL_HALF : KMER_CANONICAL;
+  long long max_ent = kmer_space(k_mers, mode);
+  // each process reports my_ent entries to the histogram, the last one
+  // also takes the remainder
+  long long my_low = myr * (max_ent / c_size);
+  long long my_high = (myr == c_size - 1) ? max_ent : my_low + max_ent / c_size;
+  long long my_ent = my_high - my_low;
+  // huge pages, zeroed lazily by the kernel
+  unsigned int* histogram = (unsigned int*) hugemem_alloc (my_ent
+							   * sizeof(unsigned int));
   assert(histogram != NULL);
 
 #ifdef DEBUG
@@ -70,128 +135,90 @@ int main(int argc, char *argv[])
 	 c_size, k_mers, max_ent, my_ent);
 #endif // DEBUG
  
-  char** all_sq;
-  int all_sq_sz;
-  int n_seq;
-  int* sizes; 
+  // Process 0 maps the packed cache of the file (or maps the file and
+  // packs its sequences 2 bits per base with nthreads threads), then
+  // broadcasts the packed store
+  seqstore_t store;
+  long long sizes[3];
+  int err;
   if(myr == 0)
     {
-      // Data structure for sequences
-      all_sq_sz = MAX_SQ;
-      all_sq = (char **) malloc(all_sq_sz * sizeof(char*));
-      sizes = (int *) malloc(all_sq_sz * sizeof(int));
-      assert(all_sq != NULL);
-      assert(sizes != NULL);
-      
-      /* Open file to load a sequence */
-      FILE *infp = fopen(in_file, "r");
-      assert(infp != NULL);
-      n_seq = 0;
-      while (fgets(temp_buf,MAX_LINE,infp) != NULL)
-	{
-	  // check if line is a properties line (strating with '>')
-	  if(temp_buf[0] == '>')
-	    {
-	      if(n_seq > 0)
-		{
-#ifdef DEBUG  
-		  printf("Sequence %d of size %ld is %s \n", n_seq,
-			 sq_len, sq_buffer);
-#endif
-		  sizes[n_seq - 1] = sq_len + 1;
-		  all_sq[n_seq - 1] = (char*) malloc ((sq_len + 1)
-						      *sizeof(char));
-		  assert(all_sq[n_seq - 1] != NULL);
-		  
-		  strcpy(all_sq[n_seq - 1], sq_buffer);
-		  if ( n_seq % MAX_SQ == 0)
-		    {
-		      all_sq_sz += MAX_SQ;
-		      all_sq = realloc(all_sq,(all_sq_sz*sizeof(char*)));
-		      sizes = realloc(sizes,(all_sq_sz*sizeof(int)));
-		      assert(all_sq != NULL);
-		      assert(sizes != NULL);
-		    }		   		
-		}
-	      strcpy(sq_buffer,"");
-	      sq_len = 0;
-	      n_seq++;
-	      continue; 
-	    }
-	  // to not include newline char
-	  ln_len = strlen(temp_buf) - 1;
-	  sq_len += ln_len; 
-	  strncat(sq_buffer, temp_buf, ln_len);
-	} // End While
-
-      // save last sequence
-# ifdef DEBUG  
-      printf("Sequence %d of size %ld is %s \n", n_seq, sq_len, sq_buffer);
-# endif
-      sizes[n_seq - 1] = sq_len + 1;
-      all_sq[n_seq - 1] = (char*) malloc ((sq_len + 1)*sizeof(char));
-      strcpy(all_sq[n_seq - 1], sq_buffer);
-      fclose(infp);
-      // Broadcast size of the vector (all_sq_sz) 
-      MPI_Bcast(&all_sq_sz, 1, MPI_INT, 0, c);
-      // Broadcast number of sequences (nseq)
-      MPI_Bcast(&n_seq, 1, MPI_INT, 0, c);
-      // Broadcast sizes array
-      MPI_Bcast(sizes, n_seq, MPI_INT, 0, c);
-      for(i = 0; i < n_seq; i++)
-	{
-	  MPI_Bcast(all_sq[i], sizes[i], MPI_CHAR, 0, c);
-	}
-    } //end if -  process 0 loading sequences
-  else
+      err = seqstore_load(&store, in_file, nthreads);
+      assert(err == SEQSTORE_OK);
+      sizes[0] = store.n_seq;
+      sizes[1] = store.n_bases;
+      sizes[2] = store.n_runs;
+    }
+  MPI_Bcast(sizes, 3, MPI_LONG_LONG, 0, c);
+  if(myr != 0)
     {
-      MPI_Bcast(&all_sq_sz, 1, MPI_INT, 0, c);
-      MPI_Bcast(&n_seq, 1, MPI_INT, 0, c);
-      all_sq = (char **) malloc(all_sq_sz * sizeof(char*));
-      assert(all_sq != NULL);
-      // Broadcast sizes array
-      sizes = (int*) malloc(all_sq_sz * sizeof(int));
-      assert(sizes != NULL);
-#ifdef DEBUG
-      printf("******myr: %d all_sq_sz %d n_seq %d\n", myr, all_sq_sz, n_seq);
-#endif // DEBUG
-
-      MPI_Bcast(sizes, n_seq, MPI_INT, 0, c);
-      for(i = 0; i < n_seq; i++)
-	{
+      err = seqstore_alloc(&store, sizes[0], sizes[1], sizes[2]);
+      assert(err == SEQSTORE_OK);
+    }
+  bcast_bytes(store.offsets, (store.n_seq + 1) * sizeof(uint64_t), c);
+  bcast_bytes(store.bases, seqstore_words(&store) * sizeof(uint64_t), c);
+  bcast_bytes(store.runs, store.n_runs * sizeof(seqstore_run_t), c);
 #ifdef DEBUG
-	  printf("----------myr: %d sizes[%ld] %d\n", myr, i, sizes[i]);
+  printf("myr: %d n_seq %ld n_bases %lld\n", myr, store.n_seq, sizes[1]);
 #endif // DEBUG
 
-	  all_sq[i] = (char*) malloc ((sizes[i])*sizeof(char));
-	  MPI_Bcast(all_sq[i], sizes[i], MPI_CHAR, 0, c);
-	}
-    }
-
-
-  int my_low = myr * my_ent;
-  int my_high = (myr+1) * my_ent;
 #ifdef DEBUG
   printf("Process %d ready to process sequences\n", myr);
 #endif // DEBUG
   int myoff;
   // process all sequences
   // gettimeofday(&t1, NULL);
-  myoff = process_all_sq (all_sq, n_seq, k_mers, histogram, my_low, my_high);
+  myoff = process_all_sq (&store, k_mers, mode, histogram, my_low, my_high);
   //gettimeofday(&t2, NULL);
   //elapsedTime = (t2.tv_sec - t1.tv_sec) * 1000.0;      // sec to ms
   //elapsedTime += (t2.tv_usec - t1.tv_usec) / 1000.0;   // us to ms}
   //printf("Processing time: %5.3f ms\n", elapsedTime);
 
   //Free data structure
-   for(i = 0; i < n_seq; i++)
-     {
-      free(all_sq[i]);
-    }
-   free(all_sq);
-   free(sizes);
+   seqstore_free(&store);
 
 
+   if (want_spectrum || top_n > 0)
+     {
+       /* Summarize the range of this process, then merge the summaries
+	  on process 0, which writes them to out_file */
+       kmstat_spectrum_t spec, *spectrum = NULL;
+       kmstat_top_t best, *top = NULL;
+       unsigned int fq;
+       long long index;
+       if (want_spectrum)
+	 {
+	   err = kmstat_spectrum_init(&spec);
+	   assert(err == KMSTAT_OK);
+	   spectrum = &spec;
+	 }
+       else
+	 {
+	   err = kmstat_top_init(&best, top_n);
+	   assert(err == KMSTAT_OK);
+	   top = &best;
+	 }
+       for (index = 0LL; index < my_ent; index++)
+	 if ((fq = histogram[index]) != 0)
+	   {
+	     if (spectrum != NULL)
+	       kmstat_spectrum_add(spectrum, fq);
+	     else
+	       kmstat_top_add(top, kmer_of_index(index + my_low, k_mers, mode),
+			      fq);
+	   }
+       merge_report (spectrum, top, myr, c_size, c);
+       if (myr == 0)
+	 write_report (out_file, spectrum, top, k_mers);
+       if (spectrum != NULL)
+	 kmstat_spectrum_free(spectrum);
+       if (top != NULL)
+	 kmstat_top_free(top);
+       hugemem_free(histogram, my_ent * sizeof(unsigned int));
+       MPI_Finalize();
+       return 0;
+     }
+
    int* offsets;
    offsets = malloc(sizeof(int)*c_size);
    MPI_Allgather(&myoff, 1, MPI_INT, offsets, 1, MPI_INT, c);
@@ -233,9 +260,9 @@ int main(int argc, char *argv[])
      {
        if((fq = histogram[index])!=0)
 	 {
-	   get_char(sindex, k_mers, index + my_low);
+	   get_char(sindex, k_mers, kmer_of_index(index + my_low, k_mers, mode));
 	   sprintf(buff,"%s %10u\n", sindex, fq);
-	   MPI_File_write_all(file, buff, (k_mers+12), MPI_CHAR, &status);
+	   MPI_File_write(file, buff, (k_mers+12), MPI_CHAR, &status);
 	 }	  
      }
    MPI_File_close(&file);
@@ -258,69 +285,159 @@ int main(int argc, char *argv[])
      }
    fclose(outfp);
    */
-   free(histogram);
+   hugemem_free(histogram, my_ent * sizeof(unsigned int));
    MPI_Finalize();
    
    return 0;
 }
 
-int process_all_sq (char** all, size_t sq_num, int k_mers,
-		     unsigned int* histogram, int low, int high)
+int process_all_sq (const seqstore_t* store, int k_mers, int mode,
+		     unsigned int* histogram, long long low, long long high)
 {
-  int i, j, sq_len;
+  size_t i;
+  long j, n;
   // offset: count how many entries of histogram are first incremented
   int offset = 0; 
-  long long in;
-  for(i = 0; i < sq_num; i++)
+  uint64_t in[KMER_BATCH];
+  kmer_roll_t roll;
+  seqstore_cursor_t cur;
+  kmer_roll_init(&roll, k_mers, mode);
+  for(i = 0; i < store->n_seq; i++)
     {
-      sq_len = strlen(all[i]);
-      char sub_sq[k_mers + 1]; // including '\0' char
-      for(j = 0; j <= sq_len - k_mers; j++)
-	{
-	  memcpy(sub_sq, &all[i][j], k_mers);
-	  sub_sq[k_mers] = '\0';
-	  get_index(sub_sq, k_mers, &in);
-
-	  // report index only if is in my process range
-	  if(in >= low)
-	    if(in < high){
-	      if(histogram[in - low] == 0)
-		offset++;
-	      histogram[in - low]++; // = *(histogram+in) + 1;
-	    }
-#     ifdef DEBUG
-	  printf("sub sq %s , index = %lld \n",sub_sq, in);
-#     endif
-	}
+      kmer_roll_reset(&roll);
+      seqstore_cursor_init(&cur, store, i);
+      while((n = kmer_store_batch(&roll, &cur, in)) >= 0)
+	for(j = 0; j < n; j++)
+	  {
+	    // report index only if is in my process range
+	    if(in[j] >= low)
+	      if(in[j] < high){
+		if(histogram[in[j] - low] == 0)
+		  offset++;
+		histogram[in[j] - low]++; // = *(histogram+in) + 1;
+	      }
+#         ifdef DEBUG
+	    printf("index = %ld \n", in[j]);
+#         endif
+	  }
     }
   return offset;
 }
 
-void get_index(char* sq, size_t sz, long long *index)
+/*
+ * Broadcast size bytes from process 0. MPI counts are ints: send them
+ * in chunks of at most MAX_BCAST bytes.
+ */
+void bcast_bytes (void* buf, long long size, MPI_Comm c)
+{
+  long long sent;
+  for(sent = 0; sent < size; sent += MAX_BCAST)
+    {
+      int chunk = (size - sent < MAX_BCAST) ? size - sent : MAX_BCAST;
+      MPI_Bcast((char*) buf + sent, chunk, MPI_CHAR, 0, c);
+    }
+}
+
+/*
+ * Add the spectra, or the top k-mers, of all processes up on process 0.
+ */
+void merge_report (kmstat_spectrum_t* spectrum, kmstat_top_t* top, int myr,
+		   int c_size, MPI_Comm c)
 {
-  long long i;
-  *index = 0LL;
-  for(i = 0; i < sz; i++)
+  int i, n, *counts = NULL, *displs = NULL, err;
+  long long total = 0;
+  uint64_t* pairs = NULL;
+  if (myr == 0)
     {
-      // compare string from last position to first
-      //printf("char i %ld = %c\n",i, sq[sz-(i+1)] );
-      switch (sq[sz-(i+1)]) {
-      case 'A': 
-	//index += 0;   
-	break;
-      case 'C':
-	*index += 1LL << 2LL * i;   
-	break;
-      case 'G': 
-	*index += 2LL << 2LL * i;      
-	break;
-      case 'T': 
-	*index += 3LL << 2LL * i;
-	break;
-      default:
-	break;
+      counts = (int*) malloc(c_size * sizeof(int));
+      displs = (int*) malloc(c_size * sizeof(int));
+      assert(counts != NULL && displs != NULL);
+    }
+  // how many words each process sends
+  if (spectrum != NULL)
+    {
+      assert(spectrum->err == KMSTAT_OK);
+      n = spectrum->n_big;
+    }
+  else
+    n = 2 * top->n;
+  MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, c);
+  if (myr == 0)
+    for (i = 0; i < c_size; i++)
+      {
+	displs[i] = total;
+	total += counts[i];
       }
+
+  if (spectrum != NULL)
+    {
+      MPI_Reduce((myr == 0) ? MPI_IN_PLACE : spectrum->dense, spectrum->dense,
+		 KMSTAT_DENSE, MPI_UINT64_T, MPI_SUM, 0, c);
+      // the few large counts are gathered one per k-mer, after those of
+      // process 0
+      if (myr == 0)
+	{
+	  err = kmstat_spectrum_reserve(spectrum, total);
+	  assert(err == KMSTAT_OK);
+	}
+      MPI_Gatherv((myr == 0) ? MPI_IN_PLACE : spectrum->big, n, MPI_UINT64_T,
+		  spectrum->big, counts, displs, MPI_UINT64_T, 0, c);
+      if (myr == 0)
+	spectrum->n_big = total;
+    }
+  else
+    {
+      // the best k-mers of each process, as (index, count) pairs, offered
+      // to the top of process 0
+      if (myr == 0)
+	{
+	  pairs = (uint64_t*) malloc((total ? total : 1) * sizeof(uint64_t));
+	  assert(pairs != NULL);
+	}
+      MPI_Gatherv((uint64_t*) top->heap, n, MPI_UINT64_T, pairs, counts,
+		  displs, MPI_UINT64_T, 0, c);
+      if (myr == 0)
+	for (i = counts[0]; i < total; i += 2)
+	  kmstat_top_add(top, pairs[i], pairs[i + 1]);
+      free(pairs);
     }
+  free(counts);
+  free(displs);
+}
+
+/*
+ * Write the merged spectrum, or top k-mers, to out_file.
+ */
+void write_report (const char* out_file, kmstat_spectrum_t* spectrum,
+		   kmstat_top_t* top, int k_mers)
+{
+  char buff[100];
+  size_t i;
+  FILE *outfp = fopen(out_file, "w");
+  assert(outfp != NULL);
+  if (spectrum != NULL)
+    kmstat_spectrum_write(spectrum, outfp);
+  else
+    {
+      kmstat_top_sort(top);
+      for (i = 0; i < top->n; i++)
+	{
+	  get_char(buff, k_mers, top->heap[i].index);
+	  fprintf(outfp, "%s %10" PRIu64 "\n", buff, top->heap[i].count);
+	}
+    }
+  fclose(outfp);
+}
+
+/*
+ * k-mer counted at histogram index "index" (in canonical mode, the
+ * smaller strand)
+ */
+long long kmer_of_index(long long index, int k_mers, int mode)
+{
+  if (mode == KMER_CANONICAL_HALF)
+    return kmer_canonical(kmer_half_decode(index, k_mers), k_mers);
+  return index;
 }
 
 void get_char(char* sq, size_t sz, long long index)
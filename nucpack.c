@@ -0,0 +1,191 @@
+/*
+ * 2-bit nucleotide packing kernels and their run time dispatch.
+ */
+#include "nucpack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NUC_X86
+#endif
+
+#define INVALID 4
+
+/*
+ * A vector kernel packs whole words from the start while a vector load
+ * stays within avail bytes, and returns the first base it left to the
+ * scalar loop.
+ */
+typedef size_t (*pack_fn)(const char*, size_t, size_t, uint64_t*, uint32_t*);
+
+/* code of every byte, INVALID for anything but A, C, G, T (any case) */
+static unsigned char pack_tab[256];
+static pack_fn pack_kernel;   /* NULL: scalar only */
+static const char* pack_name = "scalar";
+
+/*
+ * Pack the bases src[i, n) one by one, starting at word i / 32.
+ */
+static void pack_scalar_from(const char* src, size_t i, size_t n,
+			     uint64_t* words, uint32_t* invalid)
+{
+  size_t w, j, m;
+  for(w = i / NUC_PER_WORD; i < n; w++)
+    {
+      uint64_t word = 0;
+      uint32_t bad = 0;
+      m = (n - i < NUC_PER_WORD) ? n - i : NUC_PER_WORD;
+      for(j = 0; j < m; j++)
+	{
+	  unsigned c = pack_tab[(unsigned char) src[i + j]];
+	  if(c == INVALID)
+	    bad |= 1U << j;
+	  else
+	    word |= (uint64_t) c << (2 * j);
+	}
+      words[w] = word;
+      invalid[w] = bad;
+      i += m;
+    }
+}
+
+#ifdef NUC_X86
+/*
+ * Both kernels compute the code of a byte c as ((c >> 1) ^ (c >> 2)) & 3,
+ * which maps A, C, G, T to 0, 1, 2, 3 in upper and lower case, and zero
+ * it for non bases (bases are recognized on c & 0xDF, folded case). Codes
+ * are then merged pairwise (maddubs: c0 + 4 c1, madd: + 16 (c2 + 4 c3))
+ * so byte 0 of every 32-bit lane packs four bases, and those bytes are
+ * gathered into the output word.
+ */
+
+__attribute__((target("avx2")))
+static size_t pack_avx2(const char* src, size_t n, size_t avail,
+			uint64_t* words, uint32_t* invalid)
+{
+  size_t i, w;
+  const __m256i three = _mm256_set1_epi8(3);
+  const __m256i upper = _mm256_set1_epi8((char) 0xDF);
+  const __m256i mul4 = _mm256_set1_epi16(0x0401);
+  const __m256i mul16 = _mm256_set1_epi32(0x00100001);
+  const __m256i gather = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+					  -1, -1, -1, -1, -1, -1, -1, -1,
+					  0, 4, 8, 12, -1, -1, -1, -1,
+					  -1, -1, -1, -1, -1, -1, -1, -1);
+  for(i = 0, w = 0; i < n && i + 32 <= avail; i += 32, w++)
+    {
+      __m256i c = _mm256_loadu_si256((const __m256i*)(src + i));
+      __m256i u = _mm256_and_si256(c, upper);
+      __m256i ok = _mm256_or_si256(
+	_mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('A')),
+			_mm256_cmpeq_epi8(u, _mm256_set1_epi8('C'))),
+	_mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('G')),
+			_mm256_cmpeq_epi8(u, _mm256_set1_epi8('T'))));
+      __m256i code = _mm256_xor_si256(_mm256_srli_epi16(c, 1),
+				      _mm256_srli_epi16(c, 2));
+      code = _mm256_and_si256(_mm256_and_si256(code, three), ok);
+      code = _mm256_madd_epi16(_mm256_maddubs_epi16(code, mul4), mul16);
+      code = _mm256_shuffle_epi8(code, gather);
+      uint64_t word = (uint32_t) _mm256_extract_epi32(code, 0)
+	| (uint64_t)(uint32_t) _mm256_extract_epi32(code, 4) << 32;
+      uint32_t bad = ~(uint32_t) _mm256_movemask_epi8(ok);
+      if(n - i < 32)
+	{
+	  word &= (1ULL << (2 * (n - i))) - 1;
+	  bad &= (1U << (n - i)) - 1;
+	}
+      words[w] = word;
+      invalid[w] = bad;
+    }
+  return i;
+}
+
+__attribute__((target("sse4.1")))
+static inline uint32_t pack16_sse41(const char* src, uint32_t* bad)
+{
+  const __m128i three = _mm_set1_epi8(3);
+  const __m128i mul4 = _mm_set1_epi16(0x0401);
+  const __m128i mul16 = _mm_set1_epi32(0x00100001);
+  const __m128i gather = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+				       -1, -1, -1, -1, -1, -1, -1, -1);
+  __m128i c = _mm_loadu_si128((const __m128i*) src);
+  __m128i u = _mm_and_si128(c, _mm_set1_epi8((char) 0xDF));
+  __m128i ok = _mm_or_si128(
+    _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('A')),
+		 _mm_cmpeq_epi8(u, _mm_set1_epi8('C'))),
+    _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('G')),
+		 _mm_cmpeq_epi8(u, _mm_set1_epi8('T'))));
+  __m128i code = _mm_xor_si128(_mm_srli_epi16(c, 1), _mm_srli_epi16(c, 2));
+  code = _mm_and_si128(_mm_and_si128(code, three), ok);
+  code = _mm_madd_epi16(_mm_maddubs_epi16(code, mul4), mul16);
+  code = _mm_shuffle_epi8(code, gather);
+  *bad = ~(uint32_t) _mm_movemask_epi8(ok) & 0xFFFF;
+  return (uint32_t) _mm_extract_epi32(code, 0);
+}
+
+__attribute__((target("sse4.1")))
+static size_t pack_sse41(const char* src, size_t n, size_t avail,
+			 uint64_t* words, uint32_t* invalid)
+{
+  size_t i, w;
+  uint32_t lo_bad, hi_bad;
+  for(i = 0, w = 0; i < n && i + 32 <= avail; i += 32, w++)
+    {
+      uint64_t word = pack16_sse41(src + i, &lo_bad);
+      word |= (uint64_t) pack16_sse41(src + i + 16, &hi_bad) << 32;
+      uint32_t bad = lo_bad | hi_bad << 16;
+      if(n - i < 32)
+	{
+	  word &= (1ULL << (2 * (n - i))) - 1;
+	  bad &= (1U << (n - i)) - 1;
+	}
+      words[w] = word;
+      invalid[w] = bad;
+    }
+  return i;
+}
+#endif // NUC_X86
+
+/*
+ * Pick the kernel once, before main, so threads never race on it.
+ */
+__attribute__((constructor))
+static void nuc_pack_select(void)
+{
+  int c;
+  for(c = 0; c < 256; c++)
+    pack_tab[c] = INVALID;
+  pack_tab['A'] = pack_tab['a'] = 0;
+  pack_tab['C'] = pack_tab['c'] = 1;
+  pack_tab['G'] = pack_tab['g'] = 2;
+  pack_tab['T'] = pack_tab['t'] = 3;
+
+  pack_name = "scalar";
+  pack_kernel = NULL;
+#ifdef NUC_X86
+  // __builtin_cpu_supports reads the cpuid feature bits (and checks
+  // the OS saves the AVX state)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    {
+      pack_name = "avx2";
+      pack_kernel = pack_avx2;
+    }
+  else if(__builtin_cpu_supports("sse4.1"))
+    {
+      pack_name = "sse4.1";
+      pack_kernel = pack_sse41;
+    }
+#endif
+}
+
+void nuc_pack(const char* src, size_t n, size_t avail,
+	      uint64_t* words, uint32_t* invalid)
+{
+  size_t i = pack_kernel ? pack_kernel(src, n, avail, words, invalid) : 0;
+  pack_scalar_from(src, i, n, words, invalid);
+}
+
+const char* nuc_pack_kernel(void)
+{
+  return pack_name;
+}
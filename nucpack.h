@@ -0,0 +1,46 @@
+/**
+ *   \file nucpack.h
+ *   \brief Packs ASCII nucleotides into 2-bit codes.
+ *
+ *  Bases are packed 32 per 64-bit word, base i of a word in bits 2i and
+ *  2i+1 (A=0, C=1, G=2, T=3, lowercase folded to uppercase).  Bit i of
+ *  the matching 32-bit invalid mask is set when byte i is not a base
+ *  (N, IUPAC codes, ...); such bytes pack as A.
+ *  The AVX2 (32 bases per step) or SSE4.1 (16 bases per step) kernel is
+ *  chosen at run time from the cpuid feature bits, with a scalar
+ *  fallback, so one binary runs on every node type.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __NUCPACK_H__
+#define __NUCPACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NUC_PER_WORD 32
+
+/*
+ * Pack the n bases at src into words[(n + 31) / 32] and flag the bytes
+ * that are not bases in invalid[(n + 31) / 32]. Bits of the last word
+ * beyond n are zero. "avail" (>= n) is the number of bytes that can be
+ * read at src: the kernels load whole vectors while it allows.
+ */
+extern void nuc_pack(const char* src, size_t n, size_t avail,
+		     uint64_t* words, uint32_t* invalid);
+
+/*
+ * Name of the kernel nuc_pack runs on this CPU: "avx2", "sse4.1" or
+ * "scalar".
+ */
+extern const char* nuc_pack_kernel(void);
+
+/*
+ * 2-bit code of base i of a packed word.
+ */
+static inline unsigned nuc_code(uint64_t word, int i)
+{
+  return (word >> (2 * i)) & 3;
+}
+
+#endif // __NUCPACK_H__
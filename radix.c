@@ -0,0 +1,73 @@
+/*
+ * Radix-partitioned histogram counter.
+ */
+#include "radix.h"
+
+#include <stdlib.h>
+
+int radix_init(radix_count_t* rc, ccount_t* histogram)
+{
+  int bits = 0, pbits;
+  while((1LL << bits) < histogram->n_ent)
+    bits++;
+  pbits = bits - RADIX_SLICE_BITS;
+  if(pbits < 0)
+    pbits = 0;
+  if(pbits > RADIX_MAX_BITS)
+    pbits = RADIX_MAX_BITS;
+  // offsets in a slice are 32-bit
+  if(bits - pbits > 32)
+    return RADIX_ERR;
+  rc->histogram = histogram;
+  rc->parts = 1 << pbits;
+  rc->shift = bits - pbits;
+  rc->mask = (uint32_t)((1ULL << rc->shift) - 1);
+  rc->buf = (uint32_t*) malloc((size_t) rc->parts * RADIX_BUF
+			       * sizeof(uint32_t));
+  rc->fill = (uint32_t*) calloc(rc->parts, sizeof(uint32_t));
+  if(rc->buf == NULL || rc->fill == NULL)
+    {
+      radix_free(rc);
+      return RADIX_ERR;
+    }
+  return RADIX_OK;
+}
+
+/*
+ * Inlined for each counter width.
+ */
+static inline __attribute__((always_inline))
+void drain(radix_count_t* rc, int p, const int width)
+{
+  uint64_t slice = (uint64_t) p << rc->shift;
+  const uint32_t* b = rc->buf + (size_t) p * RADIX_BUF;
+  uint32_t i, n = rc->fill[p];
+  for(i = 0; i < n; i++)
+    ccount_inc_w(rc->histogram, slice + b[i], width);
+  rc->fill[p] = 0;
+}
+
+void radix_drain(radix_count_t* rc, int p)
+{
+  if(rc->histogram->width == 1)
+    drain(rc, p, 1);
+  else if(rc->histogram->width == 2)
+    drain(rc, p, 2);
+  else
+    drain(rc, p, 4);
+}
+
+void radix_flush(radix_count_t* rc)
+{
+  int p;
+  for(p = 0; p < rc->parts; p++)
+    radix_drain(rc, p);
+}
+
+void radix_free(radix_count_t* rc)
+{
+  free(rc->buf);
+  free(rc->fill);
+  rc->buf = NULL;
+  rc->fill = NULL;
+}
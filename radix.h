@@ -0,0 +1,75 @@
+/**
+ *   \file radix.h
+ *   \brief Radix-partitioned counting into a large dense histogram.
+ *
+ *  Incrementing a histogram much larger than the caches costs a DRAM
+ *  access and a TLB miss per k-mer.  The counter splits the histogram
+ *  in slices of 1 << RADIX_SLICE_BITS entries (256 KB, sized for L2)
+ *  and first appends each index to a buffer of its slice, keyed on the
+ *  high bits of the index.  A full buffer is drained into its slice in
+ *  one go, so the increments of a drain stay in a few pages.  At most
+ *  1 << RADIX_MAX_BITS buffers are kept, larger histograms get larger
+ *  slices.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __RADIX_H__
+#define __RADIX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ccount.h"
+
+#define RADIX_ERR -1   /* Memory error */
+#define RADIX_OK 0     /* OK */
+
+#define RADIX_SLICE_BITS 16   /* entries of a slice that fits in L2 */
+#define RADIX_MAX_BITS 10     /* at most 1024 partitions */
+#define RADIX_BUF 4096        /* indexes buffered per partition */
+
+typedef struct radix_count_s
+{
+  ccount_t* histogram;
+  uint32_t* buf;    /* RADIX_BUF offsets in its slice per partition */
+  uint32_t* fill;   /* offsets held by each buffer */
+  uint32_t mask;    /* offset of an index in its slice */
+  int shift;        /* index bits below the partition number */
+  int parts;
+} radix_count_t;
+
+/*
+ * Set up a counter of indexes into histogram, whose size is a power
+ * of 2. Return RADIX_OK or RADIX_ERR.
+ */
+extern int radix_init(radix_count_t* rc, ccount_t* histogram);
+
+/*
+ * Add the buffered indexes of partition p to the histogram.
+ */
+extern void radix_drain(radix_count_t* rc, int p);
+
+/*
+ * Drain every buffer: the histogram is up to date.
+ */
+extern void radix_flush(radix_count_t* rc);
+
+extern void radix_free(radix_count_t* rc);
+
+/*
+ * Count the n indexes at "in".
+ */
+static inline void radix_add(radix_count_t* rc, const uint64_t* in, long n)
+{
+  long j;
+  uint64_t p;
+  for(j = 0; j < n; j++)
+    {
+      p = in[j] >> rc->shift;
+      rc->buf[p * RADIX_BUF + rc->fill[p]] = (uint32_t) in[j] & rc->mask;
+      if(++rc->fill[p] == RADIX_BUF)
+	radix_drain(rc, p);
+    }
+}
+
+#endif // __RADIX_H__
@@ -0,0 +1,406 @@
+/*
+ * Packed 2-bit sequence store.
+ */
+#include "seqstore.h"
+#include "nucpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PACK_CHUNK 1024      /* bases packed per nuc_pack call */
+#define MIN_BASES (1 << 20)  /* do not split below this many bytes per thread */
+#define INITIAL_RUNS 64
+#define CACHE_MAGIC "SQSTORE1"
+
+/*
+ * Start of a cache file, followed by the offsets (n_seq + 1 words), the
+ * bases (seqstore_words() + 1 words) and the runs.
+ */
+typedef struct cache_header_s
+{
+  char magic[8];
+  uint64_t n_seq;
+  uint64_t n_bases;
+  uint64_t n_runs;
+  uint64_t src_size;   /* size and modification time of the fasta file */
+  int64_t src_sec;
+  int64_t src_nsec;
+  uint64_t reserved;
+} cache_header_t;
+
+typedef struct pack_job_s
+{
+  seqstore_t* s;
+  const fasta_seq_t* all;
+  size_t lo, hi;          /* records of the job */
+  uint64_t first, last;   /* words shared with the neighbour jobs */
+  seqstore_run_t* runs;
+  size_t n_runs, cap_runs;
+  int err;
+  int running;
+  pthread_t tid;
+} pack_job_t;
+
+static uint64_t record_bases(const fasta_seq_t* sq)
+{
+  fasta_cursor_t cur;
+  const char* line;
+  uint64_t n = 0;
+  fasta_cursor_init(&cur, sq);
+  while(1)
+    {
+      size_t len = fasta_cursor_line(&cur, &line, sq->len);
+      if(len == 0)
+	return n;
+      n += len;
+    }
+}
+
+/*
+ * OR v into word i of the store. The words at both ends of a job may
+ * also be written by the jobs next to it.
+ */
+static inline void or_word(pack_job_t* job, uint64_t i, uint64_t v)
+{
+  if(i == job->first || i == job->last)
+    __atomic_fetch_or(&job->s->bases[i], v, __ATOMIC_RELAXED);
+  else
+    job->s->bases[i] |= v;
+}
+
+static int add_invalid(pack_job_t* job, uint64_t pos)
+{
+  if(job->n_runs > 0)
+    {
+      seqstore_run_t* last = &job->runs[job->n_runs - 1];
+      if(last->pos + last->len == pos)
+	{
+	  last->len++;
+	  return SEQSTORE_OK;
+	}
+    }
+  if(job->n_runs == job->cap_runs)
+    {
+      size_t cap = job->cap_runs ? 2 * job->cap_runs : INITIAL_RUNS;
+      seqstore_run_t* r = realloc(job->runs, cap * sizeof(seqstore_run_t));
+      if(r == NULL)
+	return SEQSTORE_ERR;
+      job->runs = r;
+      job->cap_runs = cap;
+    }
+  job->runs[job->n_runs].pos = pos;
+  job->runs[job->n_runs].len = 1;
+  job->n_runs++;
+  return SEQSTORE_OK;
+}
+
+static void* pack_worker(void* arg)
+{
+  pack_job_t* job = (pack_job_t*) arg;
+  uint64_t words[PACK_CHUNK / NUC_PER_WORD], pos, v;
+  uint32_t invalid[PACK_CHUNK / NUC_PER_WORD], bad;
+  const char* line;
+  fasta_cursor_t cur;
+  size_t i, j, len, nb;
+  int shift;
+
+  job->err = SEQSTORE_OK;
+  for(i = job->lo; i < job->hi; i++)
+    {
+      pos = job->s->offsets[i];
+      fasta_cursor_init(&cur, &job->all[i]);
+      while((len = fasta_cursor_line(&cur, &line, PACK_CHUNK)) > 0)
+	{
+	  nuc_pack(line, len, cur.end - line, words, invalid);
+	  for(j = 0; j < len; j += NUC_PER_WORD, pos += nb)
+	    {
+	      nb = (len - j < NUC_PER_WORD) ? len - j : NUC_PER_WORD;
+	      v = words[j / NUC_PER_WORD];
+	      shift = 2 * (pos % 32);
+	      or_word(job, pos / 32, v << shift);
+	      if(shift != 0 && 2 * nb + shift > 64)
+		or_word(job, pos / 32 + 1, v >> (64 - shift));
+	      for(bad = invalid[j / NUC_PER_WORD]; bad != 0; bad &= bad - 1)
+		if(add_invalid(job, pos + __builtin_ctz(bad)) != SEQSTORE_OK)
+		  {
+		    job->err = SEQSTORE_ERR;
+		    return NULL;
+		  }
+	    }
+	}
+    }
+  return NULL;
+}
+
+int seqstore_alloc(seqstore_t* s, size_t n_seq, uint64_t n_bases,
+		   size_t n_runs)
+{
+  s->n_seq = n_seq;
+  s->n_bases = n_bases;
+  s->n_runs = n_runs;
+  s->map = NULL;
+  s->map_size = 0;
+  s->bases = (uint64_t*) calloc(seqstore_words(s) + 1, sizeof(uint64_t));
+  s->offsets = (uint64_t*) malloc((n_seq + 1) * sizeof(uint64_t));
+  s->runs = (seqstore_run_t*) malloc((n_runs + 1) * sizeof(seqstore_run_t));
+  if(!s->bases || !s->offsets || !s->runs)
+    {
+      seqstore_free(s);
+      return SEQSTORE_ERR;
+    }
+  return SEQSTORE_OK;
+}
+
+int seqstore_build(seqstore_t* s, const fasta_seq_t* all, size_t n,
+		   int nthreads)
+{
+  size_t i, text = 0;
+  uint64_t* offsets;
+  pack_job_t* jobs;
+  int t, err = SEQSTORE_OK;
+
+  offsets = (uint64_t*) malloc((n + 1) * sizeof(uint64_t));
+  if(offsets == NULL)
+    return SEQSTORE_ERR;
+  offsets[0] = 0;
+  for(i = 0; i < n; i++)
+    {
+      offsets[i + 1] = offsets[i] + record_bases(&all[i]);
+      text += all[i].len;
+    }
+  if(seqstore_alloc(s, n, offsets[n], 0) != SEQSTORE_OK)
+    {
+      free(offsets);
+      return SEQSTORE_ERR;
+    }
+  memcpy(s->offsets, offsets, (n + 1) * sizeof(uint64_t));
+  free(offsets);
+
+  if(nthreads > text / MIN_BASES + 1)
+    nthreads = text / MIN_BASES + 1;
+  if(nthreads < 1)
+    nthreads = 1;
+  jobs = (pack_job_t*) calloc(nthreads, sizeof(pack_job_t));
+  if(jobs == NULL)
+    {
+      seqstore_free(s);
+      return SEQSTORE_ERR;
+    }
+  // split the records in runs of about the same number of bases
+  for(t = 0, i = 0; t < nthreads; t++)
+    {
+      jobs[t].s = s;
+      jobs[t].all = all;
+      jobs[t].lo = i;
+      while(i < n && s->offsets[i] < s->n_bases * (t + 1) / nthreads)
+	i++;
+      if(t == nthreads - 1)
+	i = n;
+      jobs[t].hi = i;
+      jobs[t].first = s->offsets[jobs[t].lo] / 32;
+      jobs[t].last = s->offsets[jobs[t].hi] / 32;
+      jobs[t].running = (t > 0) &&
+	(pthread_create(&jobs[t].tid, NULL, pack_worker, &jobs[t]) == 0);
+    }
+  for(t = 0; t < nthreads; t++)
+    if(!jobs[t].running)
+      pack_worker(&jobs[t]);
+
+  // concatenate the runs of every job, in position order
+  s->n_runs = 0;
+  for(t = 0; t < nthreads; t++)
+    {
+      if(jobs[t].running)
+	pthread_join(jobs[t].tid, NULL);
+      if(jobs[t].err != SEQSTORE_OK)
+	err = SEQSTORE_ERR;
+      s->n_runs += jobs[t].n_runs;
+    }
+  free(s->runs);
+  s->runs = (seqstore_run_t*) malloc((s->n_runs + 1) * sizeof(seqstore_run_t));
+  if(s->runs == NULL)
+    err = SEQSTORE_ERR;
+  for(t = 0, i = 0; t < nthreads; t++)
+    {
+      if(err == SEQSTORE_OK)
+	{
+	  memcpy(s->runs + i, jobs[t].runs,
+		 jobs[t].n_runs * sizeof(seqstore_run_t));
+	  i += jobs[t].n_runs;
+	}
+      free(jobs[t].runs);
+    }
+  free(jobs);
+  if(err != SEQSTORE_OK)
+    seqstore_free(s);
+  return err;
+}
+
+void seqstore_free(seqstore_t* s)
+{
+  if(s->map != NULL)
+    munmap(s->map, s->map_size);
+  else
+    {
+      free(s->bases);
+      free(s->offsets);
+      free(s->runs);
+    }
+  s->map = NULL;
+  s->map_size = 0;
+  s->bases = s->offsets = NULL;
+  s->runs = NULL;
+  s->n_seq = s->n_runs = s->n_bases = 0;
+}
+
+void seqstore_cursor_init(seqstore_cursor_t* c, const seqstore_t* s, size_t i)
+{
+  size_t lo = 0, hi = s->n_runs, mid;
+  c->s = s;
+  c->pos = s->offsets[i];
+  c->end = s->offsets[i + 1];
+  // first run ending after pos
+  while(lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if(s->runs[mid].pos + s->runs[mid].len <= c->pos)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  c->run = lo;
+}
+
+static void cache_path(char* buf, size_t n, const char* path)
+{
+  snprintf(buf, n, "%s%s", path, SEQSTORE_EXT);
+}
+
+static size_t cache_size(uint64_t n_seq, uint64_t n_bases, uint64_t n_runs)
+{
+  return sizeof(cache_header_t) + (n_seq + 1) * sizeof(uint64_t)
+    + ((n_bases + 31) / 32 + 1) * sizeof(uint64_t)
+    + n_runs * sizeof(seqstore_run_t);
+}
+
+int seqstore_save(const seqstore_t* s, const char* path)
+{
+  size_t n = strlen(path) + sizeof(SEQSTORE_EXT) + 7;
+  char cache[n], tmp[n];
+  cache_header_t h;
+  struct stat st;
+  FILE* fp;
+  int fd, ok;
+
+  if(stat(path, &st) != 0)
+    return SEQSTORE_ERR;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+  h.n_seq = s->n_seq;
+  h.n_bases = s->n_bases;
+  h.n_runs = s->n_runs;
+  h.src_size = st.st_size;
+  h.src_sec = st.st_mtim.tv_sec;
+  h.src_nsec = st.st_mtim.tv_nsec;
+
+  // write a temporary file of a unique name next to the cache and
+  // rename it: concurrent runs neither write the same file nor map a
+  // partial cache
+  cache_path(cache, n, path);
+  snprintf(tmp, n, "%s.XXXXXX", cache);
+  fd = mkstemp(tmp);
+  if(fd < 0)
+    return SEQSTORE_ERR;
+  // mkstemp leaves it readable by the owner only
+  fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  fp = fdopen(fd, "wb");
+  if(fp == NULL)
+    {
+      close(fd);
+      unlink(tmp);
+      return SEQSTORE_ERR;
+    }
+  ok = fwrite(&h, sizeof(h), 1, fp) == 1
+    && fwrite(s->offsets, sizeof(uint64_t), s->n_seq + 1, fp) == s->n_seq + 1
+    && fwrite(s->bases, sizeof(uint64_t), seqstore_words(s) + 1, fp)
+       == seqstore_words(s) + 1
+    && fwrite(s->runs, sizeof(seqstore_run_t), s->n_runs, fp) == s->n_runs;
+  ok = (fclose(fp) == 0) && ok;
+  if(!ok || rename(tmp, cache) != 0)
+    {
+      unlink(tmp);
+      return SEQSTORE_ERR;
+    }
+  return SEQSTORE_OK;
+}
+
+int seqstore_map(seqstore_t* s, const char* path)
+{
+  size_t n = strlen(path) + sizeof(SEQSTORE_EXT);
+  char cache[n];
+  struct stat src, st;
+  const cache_header_t* h;
+  char* p;
+  int fd;
+
+  cache_path(cache, n, path);
+  if(stat(path, &src) != 0)
+    return SEQSTORE_STALE;
+  fd = open(cache, O_RDONLY);
+  if(fd < 0)
+    return SEQSTORE_STALE;
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(cache_header_t))
+    {
+      close(fd);
+      return SEQSTORE_STALE;
+    }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED)
+    return SEQSTORE_STALE;
+  h = (const cache_header_t*) p;
+  if(memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0
+     || h->src_size != (uint64_t) src.st_size
+     || h->src_sec != src.st_mtim.tv_sec
+     || h->src_nsec != src.st_mtim.tv_nsec
+     || cache_size(h->n_seq, h->n_bases, h->n_runs) != (size_t) st.st_size)
+    {
+      munmap(p, st.st_size);
+      return SEQSTORE_STALE;
+    }
+  s->map = p;
+  s->map_size = st.st_size;
+  s->n_seq = h->n_seq;
+  s->n_bases = h->n_bases;
+  s->n_runs = h->n_runs;
+  s->offsets = (uint64_t*) (p + sizeof(cache_header_t));
+  s->bases = s->offsets + s->n_seq + 1;
+  s->runs = (seqstore_run_t*) (s->bases + seqstore_words(s) + 1);
+  return SEQSTORE_OK;
+}
+
+int seqstore_load(seqstore_t* s, const char* path, int nthreads)
+{
+  fasta_file_t f;
+  fasta_seq_t* all;
+  size_t n;
+  int err = SEQSTORE_ERR;
+
+  if(seqstore_map(s, path) == SEQSTORE_OK)
+    return SEQSTORE_OK;
+  if(fasta_open(&f, path) != FASTA_OK)
+    return SEQSTORE_ERR;
+  if(fasta_index_parallel(&f, nthreads, &all, &n) == FASTA_OK)
+    {
+      err = seqstore_build(s, all, n, nthreads);
+      free(all);
+    }
+  fasta_close(&f);
+  return err;
+}
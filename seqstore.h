@@ -0,0 +1,158 @@
+/**
+ *   \file seqstore.h
+ *   \brief Packed 2-bit store of all the sequences of an input.
+ *
+ *  The bases of every record are packed back to back in one array, 32
+ *  per 64-bit word (nucpack.h layout), with a table of record offsets.
+ *  Bytes that are not bases (N, IUPAC codes, ...) pack as A and are
+ *  listed as runs of positions, so the store takes a quarter of the
+ *  text and a few words per record and per N run.  It is made of three
+ *  flat arrays, which the MPI drivers broadcast as they are.
+ *  A store can be saved next to its fasta file ("<file>.sqs") and
+ *  mapped back with mmap by later runs, as long as the fasta file keeps
+ *  the size and modification time it had when the cache was written.
+ *  The cache is in host byte order.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __SEQSTORE_H__
+#define __SEQSTORE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fasta.h"
+
+#define SEQSTORE_STALE -2  /* No cache, or not up to date */
+#define SEQSTORE_ERR -1    /* Memory or I/O error */
+#define SEQSTORE_OK 0      /* OK */
+
+#define SEQSTORE_EXT ".sqs"   /* suffix of the cache of a fasta file */
+
+/*
+ * Run of "len" invalid bases from base "pos" of the store.
+ */
+typedef struct seqstore_run_s
+{
+  uint64_t pos;
+  uint64_t len;
+} seqstore_run_t;
+
+typedef struct seqstore_s
+{
+  uint64_t* bases;        /* seqstore_words() words of packed bases */
+  uint64_t* offsets;      /* record i holds bases [offsets[i], offsets[i+1]) */
+  seqstore_run_t* runs;   /* runs of invalid bases, by position */
+  size_t n_seq;
+  size_t n_runs;
+  uint64_t n_bases;
+  void* map;              /* mapping of a cache, NULL if malloc'd */
+  size_t map_size;
+} seqstore_t;
+
+/*
+ * Walks the bases of one record of a store.
+ */
+typedef struct seqstore_cursor_s
+{
+  const seqstore_t* s;
+  uint64_t pos;
+  uint64_t end;
+  size_t run;   /* first run that does not end before pos */
+} seqstore_cursor_t;
+
+/*
+ * Pack the records "all" (views of a fasta file) into s, with up to
+ * nthreads threads. Return SEQSTORE_OK or SEQSTORE_ERR.
+ */
+extern int seqstore_build(seqstore_t* s, const fasta_seq_t* all, size_t n,
+			  int nthreads);
+
+/*
+ * Allocate the arrays of a store of the given sizes, to be filled by
+ * the caller (e.g. received from another process).
+ * Return SEQSTORE_OK or SEQSTORE_ERR.
+ */
+extern int seqstore_alloc(seqstore_t* s, size_t n_seq, uint64_t n_bases,
+			  size_t n_runs);
+
+extern void seqstore_free(seqstore_t* s);
+
+/*
+ * Write s to the cache of the fasta file "path", stamped with its size
+ * and modification time. Return SEQSTORE_OK or SEQSTORE_ERR.
+ */
+extern int seqstore_save(const seqstore_t* s, const char* path);
+
+/*
+ * Map the cache of the fasta file "path" read-only into s. Return
+ * SEQSTORE_OK, or SEQSTORE_STALE when there is no cache for the current
+ * contents of "path".
+ */
+extern int seqstore_map(seqstore_t* s, const char* path);
+
+/*
+ * Map the cache of the fasta file "path" if it is up to date, else
+ * index and pack the file with up to nthreads threads.
+ * Return SEQSTORE_OK or SEQSTORE_ERR.
+ */
+extern int seqstore_load(seqstore_t* s, const char* path, int nthreads);
+
+/*
+ * Words of s->bases.
+ */
+static inline size_t seqstore_words(const seqstore_t* s)
+{
+  return (s->n_bases + 31) / 32;
+}
+
+/*
+ * Point c to the first base of record i.
+ */
+extern void seqstore_cursor_init(seqstore_cursor_t* c, const seqstore_t* s,
+				 size_t i);
+
+/*
+ * Return the next base of the record ('A', 'C', 'G', 'T', or 'N' for an
+ * invalid one), or -1 at the end of it.
+ */
+static inline int seqstore_cursor_next(seqstore_cursor_t* c)
+{
+  const seqstore_t* s = c->s;
+  uint64_t p = c->pos;
+  if(p >= c->end)
+    return -1;
+  c->pos++;
+  while(c->run < s->n_runs && s->runs[c->run].pos + s->runs[c->run].len <= p)
+    c->run++;
+  if(c->run < s->n_runs && s->runs[c->run].pos <= p)
+    return 'N';
+  return "ACGT"[(s->bases[p / 32] >> (2 * (p % 32))) & 3];
+}
+
+/*
+ * Mask of the invalid bases among bases [from, to) of word w, where c
+ * is; runs that end before that word are skipped.
+ */
+static inline uint32_t seqstore_invalid(seqstore_cursor_t* c, uint64_t w,
+					int from, int to)
+{
+  const seqstore_t* s = c->s;
+  uint64_t lo = w * 32 + from, hi = w * 32 + to, a, b;
+  uint32_t bad = 0;
+  for(; c->run < s->n_runs; c->run++)
+    {
+      const seqstore_run_t* run = &s->runs[c->run];
+      if(run->pos >= hi)
+	break;
+      a = (run->pos > lo) ? run->pos : lo;
+      b = (run->pos + run->len < hi) ? run->pos + run->len : hi;
+      if(b > a)
+	bad |= (uint32_t)(((1ULL << (b - a)) - 1) << (a - w * 32));
+      if(run->pos + run->len > hi)
+	break;
+    }
+  return bad;
+}
+
+#endif // __SEQSTORE_H__
@@ -0,0 +1,154 @@
+/*
+ * Open addressing counter of wide k-mer keys.
+ */
+#include "wkmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SIZE (1 << 16)
+
+void wkmer_string(char* str, const uint64_t* key, int k)
+{
+  static const char base[4] = {'A', 'C', 'G', 'T'};
+  int i, bit;
+  for(i = 0; i < k; i++)
+    {
+      bit = 2 * (k - 1 - i);
+      str[i] = base[(key[bit / 64] >> (bit % 64)) & 3];
+    }
+  str[k] = '\0';
+}
+
+static inline __attribute__((always_inline))
+size_t hash_key(const uint64_t* key, const int words)
+{
+  uint64_t h = 0;
+  int i;
+  for(i = 0; i < words; i++)
+    {
+      h = (h ^ key[i]) * 0x9E3779B97F4A7C15ULL;
+      h ^= h >> 29;
+    }
+  return h;
+}
+
+/*
+ * Slot holding key, or the free slot where it goes.
+ */
+static inline __attribute__((always_inline))
+uint64_t* probe(const wkmap_t* m, const uint64_t* key, const int words)
+{
+  size_t i = hash_key(key, words) & (m->size - 1);
+  uint64_t* slot;
+  for(;; i = (i + 1) & (m->size - 1))
+    {
+      slot = m->slots + i * (words + 1);
+      if(slot[words] == 0 || wkmer_cmp(slot, key, words) == 0)
+	return slot;
+    }
+}
+
+static int grow(wkmap_t* m, const int words)
+{
+  size_t i, old_size = m->size;
+  uint64_t *old = m->slots, *slot, *to;
+  m->slots = calloc(2 * old_size, (words + 1) * sizeof(uint64_t));
+  if(!m->slots)
+    {
+      m->slots = old;
+      return MAP_OMEM;
+    }
+  m->size = 2 * old_size;
+  for(i = 0; i < old_size; i++)
+    {
+      slot = old + i * (words + 1);
+      if(slot[words] == 0)
+	continue;
+      to = probe(m, slot, words);
+      memcpy(to, slot, (words + 1) * sizeof(uint64_t));
+    }
+  free(old);
+  return MAP_OK;
+}
+
+static inline __attribute__((always_inline))
+int add(wkmap_t* m, const uint64_t* key, uint64_t v, const int words)
+{
+  uint64_t* slot = probe(m, key, words);
+  if(slot[words] == 0)
+    {
+      // keep the load under 3/4, probe sequences stay short
+      if(4 * (m->length + 1) > 3 * m->size)
+	{
+	  if(grow(m, words) != MAP_OK)
+	    return MAP_OMEM;
+	  slot = probe(m, key, words);
+	}
+      memcpy(slot, key, words * sizeof(uint64_t));
+      m->length++;
+    }
+  slot[words] += v;
+  return MAP_OK;
+}
+
+int wkmap_init(wkmap_t* m, int words)
+{
+  return wkmap_init_size(m, words, 0);
+}
+
+int wkmap_init_size(wkmap_t* m, int words, size_t n)
+{
+  m->words = words;
+  m->stride = words + 1;
+  // the load stays under 3/4
+  m->size = INITIAL_SIZE;
+  while(4 * n > 3 * m->size)
+    m->size *= 2;
+  m->length = 0;
+  m->slots = calloc(m->size, m->stride * sizeof(uint64_t));
+  return m->slots ? MAP_OK : MAP_OMEM;
+}
+
+int wkmap_add(wkmap_t* m, const uint64_t* key)
+{
+  if(m->words == 2)
+    return add(m, key, 1, 2);
+  return add(m, key, 1, 4);
+}
+
+int wkmap_add_n(wkmap_t* m, const uint64_t* key, uint64_t v)
+{
+  if(m->words == 2)
+    return add(m, key, v, 2);
+  return add(m, key, v, 4);
+}
+
+uint64_t* wkmap_count(wkmap_t* m, const uint64_t* key)
+{
+  uint64_t* slot = (m->words == 2) ? probe(m, key, 2) : probe(m, key, 4);
+  return (slot[m->words] == 0) ? NULL : slot + m->words;
+}
+
+int wkmap_iterate(wkmap_t* m, wkmap_fn f, any_t item)
+{
+  size_t i;
+  int status;
+  uint64_t* slot;
+  for(i = 0; i < m->size; i++)
+    {
+      slot = m->slots + i * m->stride;
+      if(slot[m->words] == 0)
+	continue;
+      if((status = f(item, slot, slot[m->words])) != MAP_OK)
+	return status;
+    }
+  return MAP_OK;
+}
+
+void wkmap_free(wkmap_t* m)
+{
+  free(m->slots);
+  m->slots = NULL;
+  m->size = m->length = 0;
+}
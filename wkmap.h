@@ -0,0 +1,160 @@
+/**
+ *   \file wkmap.h
+ *   \brief Hash counter of long k-mers packed in 128 or 256-bit keys.
+ *
+ *  A k-mer of up to 64 bases is packed in 2 words, up to 128 bases in
+ *  4 words, with the same 2-bit layout as kmer.h: the first base in the
+ *  high bits of the last word, the last base in the low bits of word 0.
+ *  The map stores each key inline next to its count in an open
+ *  addressing table (linear probing, power of 2 size), so a long k-mer
+ *  costs 16 or 32 bytes instead of a 256-byte string and a pointer.
+ *  Every width class has its own copy of the probing and rolling code,
+ *  generated at compile time.
+ *
+ *   \Author: Danny Múnera - Parallel Programing UdeA
+ */
+#ifndef __WKMAP_H__
+#define __WKMAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hashmap.h"
+#include "kmer.h"
+
+#define WKMER_MAX_WORDS 4
+#define WKMER_MAX_K (WKMER_MAX_WORDS * KMER_MAX_K)   /* 128 bases */
+
+/*
+ * Words of the key of a k-mer: 2 for k <= 64, 4 for k <= 128.
+ */
+static inline int wkmer_words(int k)
+{
+  return (k <= 2 * KMER_MAX_K) ? 2 : 4;
+}
+
+/*
+ * Wide rolling encoder: the key of the last k bases read and of their
+ * reverse complement.
+ */
+typedef struct wkmer_roll_s
+{
+  uint64_t fwd[WKMER_MAX_WORDS];
+  uint64_t rev[WKMER_MAX_WORDS];
+  uint64_t mask[WKMER_MAX_WORDS];   /* valid bits of each word of fwd */
+  int k;
+  int words;
+  int filled;
+} wkmer_roll_t;
+
+static inline void wkmer_roll_init(wkmer_roll_t* r, int k)
+{
+  int i, bits;
+  for(i = 0; i < WKMER_MAX_WORDS; i++)
+    {
+      bits = 2 * k - 64 * i;
+      r->fwd[i] = r->rev[i] = 0;
+      r->mask[i] = (bits >= 64) ? ~0ULL : (bits <= 0) ? 0 : (1ULL << bits) - 1;
+    }
+  r->k = k;
+  r->words = wkmer_words(k);
+  r->filled = 0;
+}
+
+/*
+ * Shift one base into the window, as kmer_roll does. "words" must be
+ * r->words, a constant where this is inlined.
+ */
+static inline __attribute__((always_inline))
+int wkmer_roll(wkmer_roll_t* r, unsigned char base, const int words)
+{
+  unsigned code = kmer_code[base];
+  int i, top = 2 * (r->k - 1);
+  if(code == KMER_INVALID)
+    {
+      r->filled = 0;
+      return 0;
+    }
+  for(i = words - 1; i > 0; i--)
+    r->fwd[i] = ((r->fwd[i] << 2) | (r->fwd[i - 1] >> 62)) & r->mask[i];
+  r->fwd[0] = ((r->fwd[0] << 2) | code) & r->mask[0];
+  for(i = 0; i < words - 1; i++)
+    r->rev[i] = (r->rev[i] >> 2) | (r->rev[i + 1] << 62);
+  r->rev[words - 1] >>= 2;
+  r->rev[top / 64] |= (uint64_t)(3 - code) << (top % 64);
+  if(r->filled < r->k)
+    return ++r->filled == r->k;
+  return 1;
+}
+
+/*
+ * Compare two keys as numbers: <0, 0 or >0.
+ */
+static inline __attribute__((always_inline))
+int wkmer_cmp(const uint64_t* a, const uint64_t* b, const int words)
+{
+  int i;
+  for(i = words - 1; i >= 0; i--)
+    if(a[i] != b[i])
+      return (a[i] < b[i]) ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Write the k bases of a key to str (k + 1 bytes).
+ */
+extern void wkmer_string(char* str, const uint64_t* key, int k);
+
+/*
+ * Open addressing counter: slot i holds its key in slots[i * stride],
+ * followed by its count (0 for a free slot).
+ */
+typedef struct wkmap_s
+{
+  uint64_t* slots;
+  size_t size;     /* slots, a power of 2 */
+  size_t length;   /* keys held */
+  int words;
+  int stride;      /* words + 1 */
+} wkmap_t;
+
+/*
+ * Called with (item, key, count) for every key of the map. Returns a
+ * map status code, anything but MAP_OK stops the traversal.
+ */
+typedef int (*wkmap_fn)(any_t item, const uint64_t* key, uint64_t count);
+
+/*
+ * Set up an empty counter for keys of "words" words (wkmer_words).
+ * Return MAP_OK or MAP_OMEM.
+ */
+extern int wkmap_init(wkmap_t* m, int words);
+
+/*
+ * Same as wkmap_init, with room for n keys before the table grows.
+ */
+extern int wkmap_init_size(wkmap_t* m, int words, size_t n);
+
+/*
+ * Add one to the count of key, inserting it if missing.
+ * Return MAP_OK or MAP_OMEM.
+ */
+extern int wkmap_add(wkmap_t* m, const uint64_t* key);
+
+/*
+ * Add v (not 0) to the count of key, inserting it if missing.
+ * Return MAP_OK or MAP_OMEM.
+ */
+extern int wkmap_add_n(wkmap_t* m, const uint64_t* key, uint64_t v);
+
+/*
+ * Count of key, to be read or incremented in place, or NULL when key
+ * is missing.
+ */
+extern uint64_t* wkmap_count(wkmap_t* m, const uint64_t* key);
+
+extern int wkmap_iterate(wkmap_t* m, wkmap_fn f, any_t item);
+
+extern void wkmap_free(wkmap_t* m);
+
+#endif // __WKMAP_H__